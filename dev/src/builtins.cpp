@@ -32,7 +32,7 @@ int KeyCompare(const Value &a, const Value &b, bool rec = false)
     {
         case V_INT:    return a.ival < b.ival ? -1 : a.ival > b.ival;
         case V_FLOAT:  return a.fval < b.fval ? -1 : a.fval > b.fval;
-        case V_STRING: return strcmp(a.sval->str(), b.sval->str());
+        case V_STRING: return a.sval->Compare(*b.sval);
 
         case V_VECTOR:
             if (a.vval->len && b.vval->len && !rec) return KeyCompare(a.vval->at(0), b.vval->at(0), true);
@@ -43,11 +43,210 @@ int KeyCompare(const Value &a, const Value &b, bool rec = false)
     }
 }
 
+void HashMapKeyCheck(const Value &key, const char *fname)
+{
+    switch (key.type)
+    {
+        case V_INT:
+        case V_FLOAT:
+        case V_STRING:
+        case V_VECTOR:
+            return;
+        default:
+            g_vm->BuiltinError(string(fname) + ": illegal key type: " + g_vm->ProperTypeName(key));
+    }
+}
+
+Value HashMapElems(Value &m, bool keys)
+{
+    auto hm = m.hval;
+    auto nv = g_vm->NewVector(hm->len, V_VECTOR);
+    for (int i = 0; i < hm->cap; i++) if (hm->Used(i)) nv->push((keys ? hm->Key(i) : hm->Val(i)).INC());
+    m.DECRT();
+    return Value(nv);
+}
+
+// Sort keys are int/float/string values, or the first element of a vector/struct, the same as binarysearch uses.
+inline const Value &SortKey(const Value &e) { return e.type == V_VECTOR && e.vval->len ? e.vval->at(0) : e; }
+
+struct IntKeyLess
+{
+    bool operator()(const Value &a, const Value &b) const { return SortKey(a).ival < SortKey(b).ival; }
+};
+
+struct FloatKeyLess
+{
+    bool operator()(const Value &a, const Value &b) const
+    {
+        auto fa = SortKey(a).fval, fb = SortKey(b).fval;
+        return fa < fb || (fb != fb && fa == fa);  // NaNs go last, otherwise std::sort may misbehave
+    }
+};
+
+struct StringKeyLess
+{
+    bool operator()(const Value &a, const Value &b) const
+    {
+        return SortKey(a).sval->Compare(*SortKey(b).sval) < 0;
+    }
+};
+
+ValueType SortKeyType(const Value *begin, const Value *end, const char *fname)
+{
+    auto t = SortKey(*begin).type;
+    if (t != V_INT && t != V_FLOAT && t != V_STRING)
+        g_vm->BuiltinError(string(fname) + ": can only sort on int/float/string keys, not " +
+                           g_vm->ProperTypeName(SortKey(*begin)));
+    for (auto e = begin; e != end; e++) if (SortKey(*e).type != t)
+        g_vm->BuiltinError(string(fname) + ": all keys must be of the same type");
+    return t;
+}
+
+template<typename T> void SortValues(Value *begin, Value *end, bool stable, T lt)
+{
+    if (stable) stable_sort(begin, end, lt);
+    else        sort(begin, end, lt);
+}
+
+Value SortVector(Value &l, bool stable, const char *fname)
+{
+    auto len = l.vval->len;
+    if (len < 2) return l;
+    l.vval->Unshare();
+    auto begin = &l.vval->at(0), end = begin + len;
+    switch (SortKeyType(begin, end, fname))
+    {
+        case V_INT:    SortValues(begin, end, stable, IntKeyLess());    break;
+        case V_FLOAT:  SortValues(begin, end, stable, FloatKeyLess());  break;
+        case V_STRING: SortValues(begin, end, stable, StringKeyLess()); break;
+        default:       assert(0);
+    }
+    return l;
+}
+
+template<typename T> void SortOrder(vector<int> &order, const Value *keys, T lt)
+{
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return lt(keys[a], keys[b]); });
+}
+
+// A new reference to chars [start, start + size) of s, where short substrings are cheaper to copy than to refer to,
+// and longer ones share the chars of the original.
+Value SubStr(LString *s, int start, int size)
+{
+    if (size == s->len) { s->refc++; return Value(s); }
+    return Value(size < 32 ? g_vm->NewString(s->str() + start, size) : g_vm->NewStringView(s, start, size));
+}
+
+// A new vector of elements [start, start + size) of v. Like SubStr(), short ranges are copied, and longer ones are
+// views that share the elements of v until either is changed.
+Value SubVector(LVector *v, int start, int size, int type)
+{
+    if (size >= 32) return Value(g_vm->NewVectorView(v, start, size, type));
+    auto nv = g_vm->NewVector(size, type);
+    nv->append(v, start, size);
+    return Value(nv);
+}
+
+// Index of the first occurrence of sub in s at or after start, or -1.
+// memchr finds candidates for the first char much faster than comparing at every position.
+int FindStr(const char *s, int len, const char *sub, int sublen, int start)
+{
+    if (!sublen) return start;
+    auto last = s + len - sublen;
+    for (auto p = s + start; p <= last; p++)
+    {
+        p = (const char *)memchr(p, sub[0], last - p + 1);
+        if (!p) break;
+        if (!memcmp(p + 1, sub + 1, sublen - 1)) return int(p - s);
+    }
+    return -1;
+}
+
+struct CharSet
+{
+    bool in[256];
+
+    CharSet(const char *chars, int len)
+    {
+        memset(in, 0, sizeof(in));
+        for (int i = 0; i < len; i++) in[(uchar)chars[i]] = true;
+    }
+
+    bool operator()(char c) const { return in[(uchar)c]; }
+};
+
+int StartArg(const Value &start, const Value &s, const char *fname)
+{
+    if (start.type != V_INT) return 0;
+    if (start.ival < 0 || start.ival > s.sval->len) g_vm->BuiltinError(string(fname) + ": start out of range");
+    return start.ival;
+}
+
+// running hashes created by hash_new(), by handle. freed by hash_final().
+struct HashState
+{
+    enum Kind { XXH32, CRC, SHA } kind;
+    XXHash32 xxh;
+    CRC32 crc;
+    SHA256 sha;
+
+    HashState(Kind _kind, uint seed) : kind(_kind), xxh(seed) {}
+};
+
+IntResourceManagerCompact<HashState> hashstates([](HashState *hs) { delete hs; });
+
+string HexDigest(const uchar *digest, int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    string s(len * 2, 0);
+    for (int i = 0; i < len; i++) { s[i * 2] = hex[digest[i] >> 4]; s[i * 2 + 1] = hex[digest[i] & 0xF]; }
+    return s;
+}
+
+string HexDigest(uint h)
+{
+    uchar digest[] = { (uchar)(h >> 24), (uchar)(h >> 16), (uchar)(h >> 8), (uchar)h };
+    return HexDigest(digest, 4);
+}
+
+// Shared by the native A* searches: nodes are ints, the caller supplies neighbors, step costs and the heuristic.
+// Order of expansion matches astar_generic in astar.lobster: lowest F, then lowest H, then first opened.
+// Returns the path from end to start inclusive, or an empty path if end can't be reached.
+template<typename N, typename H> vector<int> AStar(int numnodes, int start, int end, N neighbors, H heuristic)
+{
+    vector<float> G(numnodes, -1);  // -1: not reached yet
+    vector<int> previous(numnodes, -1);
+    vector<bool> closed(numnodes, false);
+    PrioQueue open;
+    G[start] = 0;
+    auto h = heuristic(start);
+    open.Push(start, h, h);
+    while (open.Size())
+    {
+        auto n = open.Pop();
+        if (n == end) break;
+        closed[n] = true;
+        neighbors(n, [&](int nn, float cost)
+        {
+            if (closed[nn] || cost <= 0) return;
+            auto g = G[n] + cost;
+            if (G[nn] >= 0 && g >= G[nn]) return;
+            G[nn] = g;
+            previous[nn] = n;
+            auto h = heuristic(nn);
+            open.Push(nn, g + h, h);
+        });
+    }
+    vector<int> path;
+    if (G[end] >= 0) for (int n = end; n >= 0; n = previous[n]) path.push_back(n);
+    return path;
+}
+
 void AddBuiltins()
 {
     STARTDECL(print) (Value &a)
     {
-        Output(OUTPUT_PROGRAM, a.ToString(g_vm->programprintprefs).c_str());
+        Output(OUTPUT_PROGRAM, g_vm->ToStringBuf(a).c_str());
         return a;
     }
     ENDDECL1(print, "x", "A", "A",
@@ -116,6 +315,21 @@ void AddBuiltins()
 
     STARTDECL(append) (Value &v1, Value &v2)
     {
+        if (!v1.vval->len || !v2.vval->len)
+        {
+            auto &from = v1.vval->len ? v1 : v2;
+            auto r = SubVector(from.vval, 0, from.vval->len, V_VECTOR);
+            v1.DEC();
+            v2.DEC();
+            return r;
+        }
+        // nothing else can see v1 if this is its only reference, so it can be appended to instead of copied
+        if (v1.vval->refc == 1 && v1.vval->type == V_VECTOR)
+        {
+            v1.vval->append(v2.vval, 0, v2.vval->len);
+            v2.DEC();
+            return v1;
+        }
         auto nv = g_vm->NewVector(v1.vval->len + v2.vval->len, V_VECTOR);
         nv->append(v1.vval, 0, v1.vval->len); v1.DEC();
         nv->append(v2.vval, 0, v2.vval->len); v2.DEC();
@@ -138,12 +352,15 @@ void AddBuiltins()
         {
             case V_INT:    return a;
             case V_VECTOR:
-            case V_STRING: { auto len = a.lobj->len; a.DECRT(); return Value(len); }
+            case V_STRING:
+            case V_HASHMAP:
+            case V_PRIOQUEUE:
+            case V_STRBUILDER: { auto len = a.lobj->len; a.DECRT(); return Value(len); }
             default: return g_vm->BuiltinError(string("illegal type passed to length: ") + BaseTypeName(a.type));
         }
     }
     ENDDECL1(length, "xs", "A", "I",
-        "length of vector/string/int");
+        "length of vector/string/int, or the number of entries in a hashmap/prioqueue/strbuilder");
 
     STARTDECL(equal) (Value &a, Value &b)
     {
@@ -279,15 +496,321 @@ void AddBuiltins()
         " As key you can use a int/float/string value, or if you use a vector, the first element of it will be used"
         " as the search key (allowing you to model a set/map/multiset/multimap using this one function). ");
 
+    STARTDECL(hashmap_new) (Value &n)
+    {
+        return Value(g_vm->NewHashMap(max(n.ival, 0)));
+    }
+    ENDDECL1(hashmap_new, "n", "i", "H",
+        "creates an empty hashmap. optionally pass the number of entries it should fit without having to grow."
+        " keys can be int/float/string/vector/struct values, and compare the same way equal() does.");
+
+    STARTDECL(hashmap_set) (Value &m, Value &key, Value &x)
+    {
+        HashMapKeyCheck(key, "hashmap_set");
+        m.hval->Set(key, x);
+        return m;
+    }
+    ENDDECL3(hashmap_set, "map,key,x", "HAA", "H",
+        "sets the value for key to x, replacing any existing value. returns the hashmap."
+        " don't modify a vector/struct after using it as a key.");
+
+    STARTDECL(hashmap_get) (Value &m, Value &key, Value &def)
+    {
+        ValueRef mref(m), kref(key);
+        auto v = m.hval->Find(key);
+        if (!v) return def;
+        def.DEC();
+        return v->INC();
+    }
+    ENDDECL3(hashmap_get, "map,key,default", "HAa", "A",
+        "returns the value stored for key, or default (nil if not given) if there is none.");
+
+    STARTDECL(hashmap_has) (Value &m, Value &key)
+    {
+        ValueRef mref(m), kref(key);
+        return Value(m.hval->Find(key) != nullptr);
+    }
+    ENDDECL2(hashmap_has, "map,key", "HA", "I",
+        "returns whether there is a value stored for key.");
+
+    STARTDECL(hashmap_remove) (Value &m, Value &key)
+    {
+        ValueRef mref(m), kref(key);
+        return m.hval->Remove(key);
+    }
+    ENDDECL2(hashmap_remove, "map,key", "HA", "A",
+        "removes the entry for key, returns the value that was stored, or nil if there was none.");
+
+    STARTDECL(hashmap_keys) (Value &m)
+    {
+        return HashMapElems(m, true);
+    }
+    ENDDECL1(hashmap_keys, "map", "H", "A]",
+        "returns a vector of all keys in the hashmap, in no particular order.");
+
+    STARTDECL(hashmap_values) (Value &m)
+    {
+        return HashMapElems(m, false);
+    }
+    ENDDECL1(hashmap_values, "map", "H", "A]",
+        "returns a vector of all values in the hashmap, in the same order as hashmap_keys().");
+
+    STARTDECL(prioqueue_new) ()
+    {
+        return Value(g_vm->NewPrioQueue());
+    }
+    ENDDECL0(prioqueue_new, "", "", "Q",
+        "creates an empty priority queue of int ids (>= 0, e.g. indices into a vector of objects),"
+        " ordered by lowest priority first. use length() to see how many ids are queued.");
+
+    STARTDECL(prioqueue_push) (Value &q, Value &id, Value &prio, Value &tie)
+    {
+        if (id.ival < 0) g_vm->BuiltinError("prioqueue_push: id must be >= 0");
+        q.qval->pq.Push(id.ival, prio.fval, tie.type == V_FLOAT ? tie.fval : 0);
+        q.qval->Sync();
+        return q;
+    }
+    ENDDECL4(prioqueue_push, "q,id,prio,tie", "QIFf", "Q",
+        "queues id with the given priority. if it is already queued, changes its priority instead (decrease-key)."
+        " ids with equal priority are ordered by the optional tie value, and then by which was queued first."
+        " returns the queue.");
+
+    STARTDECL(prioqueue_pop) (Value &q)
+    {
+        ValueRef qref(q);
+        if (!q.qval->len) g_vm->BuiltinError("prioqueue_pop: queue is empty");
+        auto id = q.qval->pq.Pop();
+        q.qval->Sync();
+        return Value(id);
+    }
+    ENDDECL1(prioqueue_pop, "q", "Q", "I",
+        "removes the id with the lowest priority from the queue and returns it.");
+
+    STARTDECL(prioqueue_top) (Value &q)
+    {
+        ValueRef qref(q);
+        if (!q.qval->len) g_vm->BuiltinError("prioqueue_top: queue is empty");
+        g_vm->Push(Value(q.qval->pq.Top()));
+        return Value(q.qval->pq.TopPrio());
+    }
+    ENDDECL1(prioqueue_top, "q", "Q", "IF",
+        "returns the id with the lowest priority and its priority, without removing it.");
+
+    STARTDECL(prioqueue_contains) (Value &q, Value &id)
+    {
+        ValueRef qref(q);
+        return Value(q.qval->pq.Contains(id.ival));
+    }
+    ENDDECL2(prioqueue_contains, "q,id", "QI", "I",
+        "returns whether id is currently queued.");
+
+    STARTDECL(strbuilder_new) (Value &n)
+    {
+        return Value(g_vm->NewStrBuilder(max(n.ival, 0)));
+    }
+    ENDDECL1(strbuilder_new, "n", "i", "B",
+        "creates an empty string builder, optionally with space for n characters. appending to it takes amortized"
+        " constant time, unlike + on strings which copies the whole string every time."
+        " use length() to see how many characters it holds.");
+
+    STARTDECL(strbuilder_append) (Value &sb, Value &x)
+    {
+        ValueRef xref(x);
+        if (x.type == V_STRING) sb.bval->buf.append(x.sval->str(), x.sval->len);
+        else x.ToString(sb.bval->buf, g_vm->programprintprefs);
+        sb.bval->Sync();
+        return sb;
+    }
+    ENDDECL2(strbuilder_append, "sb,x", "BA", "B",
+        "appends x, converted to a string the same way + on strings would do. returns the string builder.");
+
+    STARTDECL(strbuilder_append_int) (Value &sb, Value &i)
+    {
+        appendint(sb.bval->buf, i.ival);
+        sb.bval->Sync();
+        return sb;
+    }
+    ENDDECL2(strbuilder_append_int, "sb,i", "BI", "B",
+        "appends an int without any intermediate string. returns the string builder.");
+
+    STARTDECL(strbuilder_append_float) (Value &sb, Value &f, Value &decimals)
+    {
+        appendflt(sb.bval->buf, f.fval, decimals.type == V_INT ? decimals.ival : g_vm->programprintprefs.decimals);
+        sb.bval->Sync();
+        return sb;
+    }
+    ENDDECL3(strbuilder_append_float, "sb,f,decimals", "BFi", "B",
+        "appends a float without any intermediate string, optionally with a fixed number of decimals."
+        " returns the string builder.");
+
+    STARTDECL(strbuilder_tostring) (Value &sb)
+    {
+        ValueRef sbref(sb);
+        return Value(g_vm->NewString(sb.bval->buf));
+    }
+    ENDDECL1(strbuilder_tostring, "sb", "B", "S",
+        "returns everything appended so far as a new string. the string builder can still be appended to.");
+
+    STARTDECL(strbuilder_clear) (Value &sb)
+    {
+        sb.bval->buf.clear();
+        sb.bval->Sync();
+        return sb;
+    }
+    ENDDECL1(strbuilder_clear, "sb", "B", "B",
+        "empties the string builder while keeping its memory, so it can be reused. returns the string builder.");
+
+    STARTDECL(astar_native_grid) (Value &costs, Value &start, Value &end, Value &isocta)
+    {
+        ValueRef cref(costs);
+        auto s = ValueDecTo<int2>(start);
+        auto e = ValueDecTo<int2>(end);
+        auto h = costs.vval->len;
+        auto w = h ? costs.vval->at(0).vval->len : 0;
+        vector<float> cost(w * h);
+        auto mincost = -1.0f;
+        for (int y = 0; y < h; y++)
+        {
+            auto &row = costs.vval->at(y);
+            if (row.type != V_VECTOR || row.vval->len != w)
+                g_vm->BuiltinError("astar_native_grid: costs must be a rectangular grid of numbers");
+            for (int x = 0; x < w; x++)
+            {
+                auto &cv = row.vval->at(x);
+                if (cv.type != V_FLOAT && cv.type != V_INT)
+                    g_vm->BuiltinError("astar_native_grid: costs must be a rectangular grid of numbers");
+                auto c = cv.type == V_FLOAT ? cv.fval : cv.ival;
+                cost[y * w + x] = c;
+                if (c > 0 && (mincost < 0 || c < mincost)) mincost = c;
+            }
+        }
+        auto inrange = [&](const int2 &p) { return p.x() >= 0 && p.y() >= 0 && p.x() < w && p.y() < h; };
+        if (!inrange(s) || !inrange(e)) g_vm->BuiltinError("astar_native_grid: start or end not on the grid");
+
+        static const int2 dirs[] = { int2(-1, 0), int2(1, 0), int2(0, -1), int2(0, 1),
+                                     int2(-1, -1), int2(1, 1), int2(1, -1), int2(-1, 1) };
+        auto ndirs = isocta.True() ? 8 : 4;
+        auto path = AStar(w * h, s.y() * w + s.x(), e.y() * w + e.x(),
+            [&](int n, function<void(int, float)> f)
+            {
+                auto p = int2(n % w, n / w);
+                for (int i = 0; i < ndirs; i++)
+                {
+                    auto np = p + dirs[i];
+                    if (!inrange(np)) continue;
+                    auto nn = np.y() * w + np.x();
+                    f(nn, i < 4 ? cost[nn] : cost[nn] * sqrtf(2));
+                }
+            },
+            [&](int n)
+            {
+                // distance in steps times the cheapest step, so this never overestimates
+                auto d = int2(abs(n % w - e.x()), abs(n / w - e.y()));
+                auto small = (float)min(d.x(), d.y()), big = (float)max(d.x(), d.y());
+                return mincost * (ndirs == 8 ? sqrtf(2) * small + big - small : big + small);
+            });
+        auto nv = g_vm->NewVector((int)path.size(), V_VECTOR);
+        for (auto n : path) nv->push(ToValue(int2(n % w, n / w)));
+        return Value(nv);
+    }
+    ENDDECL4(astar_native_grid, "costs,start,end,isocta", "VI]I]I", "I]]",
+        "finds the cheapest path on a 2D grid, where costs[y][x] is the cost of stepping onto a cell (<= 0 for"
+        " impassable), and diagonal steps (if isocta) cost sqrt(2) times as much. returns the path as a vector of"
+        " xy_i from end to start inclusive, or an empty vector if there is none.");
+
+    STARTDECL(astar_native_graph) (Value &positions, Value &neighbors, Value &start, Value &end)
+    {
+        ValueRef pref(positions), nref(neighbors);
+        auto numnodes = positions.vval->len;
+        if (neighbors.vval->len != numnodes)
+            g_vm->BuiltinError("astar_native_graph: need a list of neighbors for every position");
+        if (start.ival < 0 || start.ival >= numnodes || end.ival < 0 || end.ival >= numnodes)
+            g_vm->BuiltinError("astar_native_graph: start or end out of range");
+        vector<float3> pos(numnodes);
+        for (int i = 0; i < numnodes; i++) pos[i] = ValueTo<float3>(positions.vval->at(i));
+        for (int i = 0; i < numnodes; i++)
+        {
+            auto &nl = neighbors.vval->at(i);
+            if (nl.type != V_VECTOR) g_vm->BuiltinError("astar_native_graph: neighbors must be vectors of ints");
+            for (int j = 0; j < nl.vval->len; j++)
+            {
+                auto &nn = nl.vval->at(j);
+                if (nn.type != V_INT || nn.ival < 0 || nn.ival >= numnodes)
+                    g_vm->BuiltinError("astar_native_graph: neighbor index out of range");
+            }
+        }
+        auto path = AStar(numnodes, start.ival, end.ival,
+            [&](int n, function<void(int, float)> f)
+            {
+                auto nl = neighbors.vval->at(n).vval;
+                for (int j = 0; j < nl->len; j++)
+                {
+                    auto nn = nl->at(j).ival;
+                    f(nn, max(length(pos[nn] - pos[n]), 0.000001f));  // coincident nodes are still connected
+                }
+            },
+            [&](int n) { return length(pos[end.ival] - pos[n]); });
+        auto nv = g_vm->NewVector((int)path.size(), V_VECTOR);
+        for (auto n : path) nv->push(Value(n));
+        return Value(nv);
+    }
+    ENDDECL4(astar_native_graph, "positions,neighbors,start,end", "VI]]II", "I]",
+        "finds the shortest path between nodes start and end in a graph, given as a position (xy/xyz) for each"
+        " node and a vector of neighbor node indices for each node. step costs are the distances between nodes."
+        " returns the node indices from end to start inclusive, or an empty vector if there is no path.");
+
+    STARTDECL(sort) (Value &l)
+    {
+        return SortVector(l, false, "sort");
+    }
+    ENDDECL1(sort, "xs", "V", "V1",
+        "sorts a vector in place in ascending order, and returns it. elements must be all ints, all floats or"
+        " all strings, or vectors/structs that start with one of those (which is then used as the key),"
+        " which is also the order binarysearch expects.");
+
+    STARTDECL(stable_sort) (Value &l)
+    {
+        return SortVector(l, true, "stable_sort");
+    }
+    ENDDECL1(stable_sort, "xs", "V", "V1",
+        "like sort, but elements with equal keys keep their original order.");
+
+    STARTDECL(sort_by_keys) (Value &l, Value &keys)
+    {
+        ValueRef kref(keys);
+        auto len = l.vval->len;
+        if (keys.vval->len != len)
+            g_vm->BuiltinError("sort_by_keys: keys must be the same length as the vector");
+        if (len < 2) return l;
+        auto kbegin = &keys.vval->at(0);
+        vector<int> order(len);
+        for (int i = 0; i < len; i++) order[i] = i;
+        switch (SortKeyType(kbegin, kbegin + len, "sort_by_keys"))
+        {
+            case V_INT:    SortOrder(order, kbegin, IntKeyLess());    break;
+            case V_FLOAT:  SortOrder(order, kbegin, FloatKeyLess());  break;
+            case V_STRING: SortOrder(order, kbegin, StringKeyLess()); break;
+            default:       assert(0);
+        }
+        l.vval->Unshare();
+        vector<Value> sorted(len);
+        for (int i = 0; i < len; i++) sorted[i] = l.vval->at(order[i]);
+        for (int i = 0; i < len; i++) l.vval->at(i) = sorted[i];
+        return l;
+    }
+    ENDDECL2(sort_by_keys, "xs,keys", "VV", "V1",
+        "stable sorts a vector in place by the int/float/string at the same index in keys, and returns it."
+        " see sort_by in std.lobster for computing the keys with a function.");
+
     STARTDECL(copy) (Value &v)
     {
-        auto nv = g_vm->NewVector(v.vval->len, v.vval->type);
-        nv->append(v.vval, 0, v.vval->len);
+        auto nv = SubVector(v.vval, 0, v.vval->len, v.vval->type);
         v.DECRT();
-        return Value(nv);
+        return nv;
     }
     ENDDECL1(copy, "xs", "V", "V1",
-        "makes a shallow copy of vector/object.");
+        "makes a shallow copy of vector/object. longer vectors share their elements with the copy until either is"
+        " changed.");
 
     STARTDECL(slice) (Value &l, Value &s, Value &e)
     {
@@ -297,14 +820,14 @@ void AddBuiltins()
         if (start < 0) start = l.vval->len + start;
         if (start < 0 || start + size > (int)l.vval->len)
             g_vm->BuiltinError("slice: values out of range");
-        auto nv = g_vm->NewVector(size, V_VECTOR);
-        nv->append(l.vval, start, size);
+        auto nv = SubVector(l.vval, start, size, V_VECTOR);
         l.DECRT();
-        return Value(nv);
+        return nv;
     }
     ENDDECL3(slice,
         "xs,start,size", "VII", "V1", "returns a sub-vector of size elements from index start."
-        " start & size can be negative to indicate an offset from the vector length.");
+        " start & size can be negative to indicate an offset from the vector length."
+        " longer slices share their elements with xs until either is changed.");
 
     STARTDECL(any) (Value &v)
     {
@@ -350,13 +873,14 @@ void AddBuiltins()
         if (start < 0 || start + size > (int)l.vval->len)
             g_vm->BuiltinError("substring: values out of range");
 
-        auto ns = g_vm->NewString(l.sval->str() + start, size);
+        auto ns = SubStr(l.sval, start, size);
         l.DECRT();
-        return Value(ns);
+        return ns;
     }
-    ENDDECL3(substring, "s,start,size", "SII", "S", 
+    ENDDECL3(substring, "s,start,size", "S&II", "S", 
         "returns a substring of size characters from index start."
-        " start & size can be negative to indicate an offset from the string length.");
+        " start & size can be negative to indicate an offset from the string length."
+        " longer substrings share memory with s rather than copying it, which keeps all of s alive while they are.");
 
     STARTDECL(tokenize) (Value &s, Value &delims, Value &whitespace)
     {
@@ -385,6 +909,220 @@ void AddBuiltins()
         " delimiter. Segments are stripped of leading and trailing whitespace."
         " Example: \"; A ; B C; \" becomes [ \"\", \"A\", \"B C\" ] with \";\" as delimiter and \" \" as whitespace." );
 
+    STARTDECL(find_string) (Value &s, Value &sub, Value &start)
+    {
+        ValueRef sref(s), subref(sub);
+        auto i = StartArg(start, s, "find_string");
+        return Value(FindStr(s.sval->str(), s.sval->len, sub.sval->str(), sub.sval->len, i));
+    }
+    ENDDECL3(find_string, "s,sub,start", "S&S&i", "I",
+        "returns the index of the first occurrence of sub in s, optionally starting the search at index start,"
+        " or -1 if there is none.");
+
+    STARTDECL(find_any) (Value &s, Value &chars, Value &start)
+    {
+        ValueRef sref(s), cref(chars);
+        auto i = StartArg(start, s, "find_any");
+        auto p = s.sval->str();
+        auto len = s.sval->len;
+        if (chars.sval->len == 1)
+        {
+            auto c = (const char *)memchr(p + i, chars.sval->str()[0], len - i);
+            return Value(c ? int(c - p) : -1);
+        }
+        CharSet cs(chars.sval->str(), chars.sval->len);
+        for (; i < len; i++) if (cs(p[i])) return Value(i);
+        return Value(-1);
+    }
+    ENDDECL3(find_any, "s,chars,start", "S&S&i", "I",
+        "returns the index of the first char in s that is any of the chars in the chars string, optionally starting"
+        " the search at index start, or -1 if there is none.");
+
+    STARTDECL(split_string) (Value &s, Value &sep)
+    {
+        ValueRef sref(s), sepref(sep);
+        if (!sep.sval->len) g_vm->BuiltinError("split_string: separator can't be empty");
+        auto v = g_vm->NewVector(0, V_VECTOR);
+        auto p = s.sval->str();
+        for (int i = 0;;)
+        {
+            auto j = FindStr(p, s.sval->len, sep.sval->str(), sep.sval->len, i);
+            if (j < 0) { v->push(SubStr(s.sval, i, s.sval->len - i)); break; }
+            v->push(SubStr(s.sval, i, j - i));
+            i = j + sep.sval->len;
+        }
+        return Value(v);
+    }
+    ENDDECL2(split_string, "s,separator", "S&S&", "S]",
+        "splits s into the (possibly empty) strings in between occurrences of separator."
+        " unlike tokenize(), this does not strip whitespace, and the result always contains at least 1 string.");
+
+    STARTDECL(split_lines) (Value &s)
+    {
+        ValueRef sref(s);
+        auto v = g_vm->NewVector(0, V_VECTOR);
+        auto p = s.sval->str();
+        auto len = s.sval->len;
+        for (int i = 0; i < len;)
+        {
+            auto nl = (const char *)memchr(p + i, '\n', len - i);
+            auto j = nl ? int(nl - p) : len;
+            auto end = j > i && p[j - 1] == '\r' ? j - 1 : j;
+            v->push(SubStr(s.sval, i, end - i));
+            i = j + 1;
+        }
+        return Value(v);
+    }
+    ENDDECL1(split_lines, "s", "S&", "S]",
+        "splits s into lines, without their \\n or \\r\\n line endings."
+        " a line ending at the very end of s does not start another (empty) line.");
+
+    STARTDECL(replace_string) (Value &s, Value &from, Value &to)
+    {
+        ValueRef sref(s), fromref(from), toref(to);
+        if (!from.sval->len) g_vm->BuiltinError("replace_string: string to replace can't be empty");
+        auto p = s.sval->str();
+        auto len = s.sval->len;
+        auto j = FindStr(p, len, from.sval->str(), from.sval->len, 0);
+        if (j < 0) return s.INC();
+        string r;
+        r.reserve(len + max(0, to.sval->len - from.sval->len) * 4);
+        for (int i = 0;;)
+        {
+            r.append(p + i, j - i);
+            if (j == len) break;
+            r.append(to.sval->str(), to.sval->len);
+            i = j + from.sval->len;
+            j = FindStr(p, len, from.sval->str(), from.sval->len, i);
+            if (j < 0) j = len;
+        }
+        return Value(g_vm->NewString(r));
+    }
+    ENDDECL3(replace_string, "s,from,to", "S&S&S&", "S",
+        "returns s with all (non-overlapping) occurrences of from replaced by to.");
+
+    STARTDECL(trim) (Value &s, Value &chars)
+    {
+        ValueRef sref(s), cref(chars);
+        auto ws = chars.type == V_STRING ? CharSet(chars.sval->str(), chars.sval->len) : CharSet(" \t\r\n", 4);
+        auto p = s.sval->str();
+        int start = 0, end = s.sval->len;
+        while (start < end && ws(p[start])) start++;
+        while (end > start && ws(p[end - 1])) end--;
+        return SubStr(s.sval, start, end - start);
+    }
+    ENDDECL2(trim, "s,chars", "S&s&", "S",
+        "returns s without any leading and trailing whitespace, or without any of the chars in the optional chars"
+        " string.");
+
+    STARTDECL(starts_with) (Value &s, Value &prefix)
+    {
+        ValueRef sref(s), pref(prefix);
+        auto n = prefix.sval->len;
+        return Value(n <= s.sval->len && !memcmp(s.sval->str(), prefix.sval->str(), n));
+    }
+    ENDDECL2(starts_with, "s,prefix", "S&S&", "I",
+        "returns whether s starts with prefix.");
+
+    STARTDECL(ends_with) (Value &s, Value &suffix)
+    {
+        ValueRef sref(s), sref2(suffix);
+        auto n = suffix.sval->len;
+        return Value(n <= s.sval->len && !memcmp(s.sval->str() + s.sval->len - n, suffix.sval->str(), n));
+    }
+    ENDDECL2(ends_with, "s,suffix", "S&S&", "I",
+        "returns whether s ends with suffix.");
+
+    STARTDECL(hash_xxh32) (Value &s, Value &seed)
+    {
+        ValueRef sref(s);
+        XXHash32 h(seed.ival);
+        h.Update(s.sval->str(), s.sval->len);
+        return Value((int)h.Final());
+    }
+    ENDDECL2(hash_xxh32, "s,seed", "S&i", "I",
+        "returns the xxHash32 of the bytes of s, with an optional seed. very fast, but not for security purposes.");
+
+    STARTDECL(hash_crc32) (Value &s)
+    {
+        ValueRef sref(s);
+        CRC32 h;
+        h.Update(s.sval->str(), s.sval->len);
+        return Value((int)h.Final());
+    }
+    ENDDECL1(hash_crc32, "s", "S&", "I",
+        "returns the CRC-32 of the bytes of s (the same as zip and png use).");
+
+    STARTDECL(hash_sha256) (Value &s)
+    {
+        ValueRef sref(s);
+        SHA256 h;
+        h.Update(s.sval->str(), s.sval->len);
+        uchar digest[32];
+        h.Final(digest);
+        return Value(g_vm->NewString(HexDigest(digest, 32)));
+    }
+    ENDDECL1(hash_sha256, "s", "S&", "S",
+        "returns the SHA-256 of the bytes of s, as 64 hex digits.");
+
+    STARTDECL(hash_new) (Value &kind, Value &seed)
+    {
+        ValueRef kref(kind);
+        auto k = kind.sval->str();
+        HashState::Kind hk = HashState::XXH32;
+        if      (!strcmp(k, "xxh32"))  hk = HashState::XXH32;
+        else if (!strcmp(k, "crc32"))  hk = HashState::CRC;
+        else if (!strcmp(k, "sha256")) hk = HashState::SHA;
+        else g_vm->BuiltinError(string("hash_new: unknown hash kind: ") + k);
+        return Value((int)hashstates.Add(new HashState(hk, seed.ival)));
+    }
+    ENDDECL2(hash_new, "kind,seed", "Si", "I",
+        "starts hashing data in chunks (e.g. a big file read with file_read_bytes()). kind is \"xxh32\", \"crc32\" or"
+        " \"sha256\", seed only applies to xxh32. returns a handle for hash_update() and hash_final().");
+
+    STARTDECL(hash_update) (Value &h, Value &s)
+    {
+        ValueRef sref(s);
+        auto hs = hashstates.Get(h.ival);
+        if (!hs) g_vm->BuiltinError("hash_update: invalid hash handle");
+        switch (hs->kind)
+        {
+            case HashState::XXH32: hs->xxh.Update(s.sval->str(), s.sval->len); break;
+            case HashState::CRC:   hs->crc.Update(s.sval->str(), s.sval->len); break;
+            case HashState::SHA:   hs->sha.Update(s.sval->str(), s.sval->len); break;
+        }
+        return h;
+    }
+    ENDDECL2(hash_update, "h,s", "IS&", "I",
+        "adds the bytes of s to the hash. returns h.");
+
+    STARTDECL(hash_final) (Value &h)
+    {
+        auto hs = hashstates.Get(h.ival);
+        if (!hs) g_vm->BuiltinError("hash_final: invalid hash handle");
+        string hex;
+        int val = 0;
+        switch (hs->kind)
+        {
+            case HashState::XXH32: val = (int)hs->xxh.Final(); hex = HexDigest(val); break;
+            case HashState::CRC:   val = (int)hs->crc.Final(); hex = HexDigest(val); break;
+            case HashState::SHA:
+            {
+                uchar digest[32];
+                hs->sha.Final(digest);
+                hex = HexDigest(digest, 32);
+                val = digest[0] << 24 | digest[1] << 16 | digest[2] << 8 | digest[3];
+                break;
+            }
+        }
+        hashstates.Delete(h.ival);
+        g_vm->Push(Value(g_vm->NewString(hex)));
+        return Value(val);
+    }
+    ENDDECL1(hash_final, "h", "I", "SI",
+        "finishes the hash and frees the handle. returns the hash as hex digits, and as an int (the first 32 bits"
+        " for sha256). for xxh32 and crc32 the int is the same as what hash_xxh32() / hash_crc32() return.");
+
     STARTDECL(unicode2string) (Value &v)
     {
         ValueRef vref(v);
@@ -467,7 +1205,7 @@ void AddBuiltins()
             for (int i = 0; i < a.vval->len; i++) { \
                 auto f = a.vval->at(i); \
                 if (otype == V_FLOAT && f.type == V_INT) f = Value(float(f.ival)); \
-                if (f.type != otype) { a.DECRT(); v->deleteself(); goto err; } \
+                if (f.type != otype) { a.DECRT(); v->deleteself(true); goto err; } \
                 v->push(Value(op)); \
             } \
             a.DECRT(); \
@@ -591,7 +1329,7 @@ void AddBuiltins()
                     {
                         case V_INT: v->push(Value(abs(f.ival))); break;
                         case V_FLOAT: v->push(Value(fabsf(f.fval))); break;
-                        default: v->deleteself(); goto err;
+                        default: v->deleteself(true); goto err;
                     }
                 }
                 a.DECRT();
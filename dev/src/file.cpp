@@ -30,11 +30,105 @@
     #endif
     #include <sys/types.h>
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
     #include <unistd.h>
+    #include <dirent.h>
 #endif
 
+#include <thread>
+#include <mutex>
+#include <atomic>
+
 using namespace lobster;
 
+// files opened by file_open(), by handle. closed by file_close(), or otherwise when we exit.
+IntResourceManagerCompact<FILE> openfiles([](FILE *f) { fclose(f); });
+
+FILE *GetFile(const Value &h, const char *fname)
+{
+    auto f = openfiles.Get(h.ival);
+    if (!f) g_vm->BuiltinError(string(fname) + ": invalid file handle");
+    return f;
+}
+
+string readbuf;  // reused for reading lines/chunks, to not allocate for every call
+
+// Positions in files opened by file_open() are 64bit, even on 32bit (the Makefile sets _FILE_OFFSET_BITS=64).
+// Lobster ints are 32bit, so they are passed to and from the VM as two: pos + high * 0x80000000.
+int64_t FileTell(FILE *f)
+{
+    #ifdef WIN32
+        return _ftelli64(f);
+    #else
+        return ftello(f);
+    #endif
+}
+
+bool FileSeek(FILE *f, int64_t pos, int whence)
+{
+    #ifdef WIN32
+        return !_fseeki64(f, pos, whence);
+    #else
+        return !fseeko(f, (off_t)pos, whence);
+    #endif
+}
+
+void UnmapFile(char *start, int len)
+{
+    #ifdef WIN32
+        (void)len;
+        UnmapViewOfFile(start);
+    #else
+        munmap(start, len);
+    #endif
+}
+
+// Maps all of fn read-only into memory, without reading it. Returns nullptr on failure, with len set to 0 if that was
+// because the file is empty (which can't be mapped).
+// Only maps files under 2GB: bigger ones don't fit in a string, and we also can't count on the address space for
+// them on 32bit.
+char *MapFile(const string &fn, int &len)
+{
+    #ifdef WIN32
+        auto fh = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fh == INVALID_HANDLE_VALUE) return nullptr;
+        LARGE_INTEGER size;
+        size.QuadPart = -1;
+        if (!GetFileSizeEx(fh, &size) || size.QuadPart <= 0 || size.QuadPart > 0x7FFFFFFF)
+        {
+            if (!size.QuadPart) len = 0;
+            CloseHandle(fh);
+            return nullptr;
+        }
+        auto mh = CreateFileMappingA(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(fh);
+        if (!mh) return nullptr;
+        auto p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mh);    // the view keeps the mapping alive
+        if (!p) return nullptr;
+        len = (int)size.QuadPart;
+        return (char *)p;
+    #else
+        int fd = open(fn.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        st.st_size = -1;
+        if (fstat(fd, &st) || st.st_size <= 0 || st.st_size > 0x7FFFFFFF)
+        {
+            if (!st.st_size) len = 0;
+            close(fd);
+            return nullptr;
+        }
+        auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);          // the mapping stays valid
+        if (p == MAP_FAILED) return nullptr;
+        len = (int)st.st_size;
+        return (char *)p;
+    #endif
+}
+
 void AddDirItem(LVector *nlist, LVector *slist, const char *filename, int64_t size, int divisor)
 {
     nlist->push(Value(g_vm->NewString(filename, strlen(filename))));
@@ -46,6 +140,170 @@ void AddDirItem(LVector *nlist, LVector *slist, const char *filename, int64_t si
     slist->push(Value(int(size)));
 }
 
+// * matches any sequence of chars, ? any single char
+bool WildcardMatch(const char *pat, const char *s)
+{
+    const char *star = nullptr, *starmatch = nullptr;
+    while (*s)
+    {
+        if (*pat == '*') { star = pat++; starmatch = s; }
+        else if (*pat == '?' || *pat == *s) { pat++; s++; }
+        else if (star) { pat = star + 1; s = ++starmatch; }
+        else return false;
+    }
+    while (*pat == '*') pat++;
+    return !*pat;
+}
+
+struct FolderEntry
+{
+    string name;    // relative to the folder being scanned, / separated
+    int64_t size;   // -1 if it couldn't be determined
+    int64_t mtime;  // seconds since 1970, 0 if it couldn't be determined
+};
+
+// Calls found for every file under folder/rel (recursively) whose name matches pattern. Stops early if stop is set.
+// Uses what the directory listing gives us to avoid a stat() for every folder and skipped file.
+void WalkFolder(const string &folder, const string &rel, const char *pattern,
+                const function<void(FolderEntry &)> &found, const atomic<bool> &stop)
+{
+    #ifdef WIN32
+
+        WIN32_FIND_DATAA fdata;
+        HANDLE fh = FindFirstFileA((folder + rel + "*.*").c_str(), &fdata);
+        if (fh == INVALID_HANDLE_VALUE) return;
+        do
+        {
+            if (!strcmp(fdata.cFileName, ".") || !strcmp(fdata.cFileName, "..")) continue;
+            if (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                if (fdata.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+                WalkFolder(folder, rel + fdata.cFileName + "\\", pattern, found, stop);
+            }
+            else if (WildcardMatch(pattern, fdata.cFileName))
+            {
+                FolderEntry e;
+                e.name = rel + fdata.cFileName;
+                replace(e.name.begin(), e.name.end(), '\\', '/');
+                e.size = ((int64_t)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+                auto t = ((int64_t)fdata.ftLastWriteTime.dwHighDateTime << 32) | fdata.ftLastWriteTime.dwLowDateTime;
+                e.mtime = (t - 116444736000000000LL) / 10000000;  // 100ns units since 1601
+                found(e);
+            }
+        }
+        while (!stop && FindNextFileA(fh, &fdata));
+        FindClose(fh);
+
+    #else
+
+        auto path = folder + rel;
+        auto dir = opendir(path.empty() ? "." : path.c_str());  // FindFirstFile treats "" as the current folder too
+        if (!dir) return;
+        while (!stop)
+        {
+            auto de = readdir(dir);
+            if (!de) break;
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+            struct stat st;
+            bool isdir = de->d_type == DT_DIR;
+            bool statted = false, statfailed = false;
+            if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK)  // not all filesystems fill in d_type
+            {
+                // if this fails (e.g. a link to nothing), it is reported as a file we know nothing else about
+                statfailed = fstatat(dirfd(dir), de->d_name, &st, 0) != 0;
+                if (!statfailed)
+                {
+                    if (S_ISDIR(st.st_mode) && de->d_type == DT_LNK) continue;  // don't follow links into cycles
+                    isdir = S_ISDIR(st.st_mode);
+                    statted = true;
+                }
+            }
+            if (isdir)
+            {
+                WalkFolder(folder, rel + de->d_name + "/", pattern, found, stop);
+            }
+            else if (WildcardMatch(pattern, de->d_name))
+            {
+                if (!statted && !statfailed) statfailed = fstatat(dirfd(dir), de->d_name, &st, 0) != 0;
+                FolderEntry e;
+                e.name = rel + de->d_name;
+                e.size = statfailed ? -1 : st.st_size;
+                e.mtime = statfailed ? 0 : st.st_mtime;
+                found(e);
+            }
+        }
+        closedir(dir);
+
+    #endif
+}
+
+string FolderRoot(const Value &folder)
+{
+    auto root = SanitizePath(folder.sval->str());
+    if (root.length() && root.back() != '/' && root.back() != '\\') root += SanitizePath("/");
+    return root;
+}
+
+int FolderEntrySize(int64_t size, int divisor)
+{
+    if (size < 0) return -1;
+    size /= max(divisor, 1);
+    return (int)min(size, (int64_t)0x7FFFFFFF);
+}
+
+// Pushes the names, sizes and times of entries, and returns the high parts of the times: those don't fit in 32bit
+// from 2038 on, so are split like file_tell() positions, into time + high * 0x80000000.
+Value FolderEntryVectors(const vector<FolderEntry> &entries, int divisor)
+{
+    auto nlist = g_vm->NewVector((int)entries.size(), V_VECTOR);
+    auto slist = g_vm->NewVector((int)entries.size(), V_VECTOR);
+    auto tlist = g_vm->NewVector((int)entries.size(), V_VECTOR);
+    auto hlist = g_vm->NewVector((int)entries.size(), V_VECTOR);
+    for (auto &e : entries)
+    {
+        nlist->push(Value(g_vm->NewString(e.name)));
+        slist->push(Value(FolderEntrySize(e.size, divisor)));
+        tlist->push(Value((int)(e.mtime % 0x80000000LL)));
+        hlist->push(Value((int)(e.mtime / 0x80000000LL)));
+    }
+    g_vm->Push(Value(nlist));
+    g_vm->Push(Value(slist));
+    g_vm->Push(Value(tlist));
+    return Value(hlist);
+}
+
+// background scans started by scan_folder_async(), by handle
+struct FolderScan
+{
+    vector<FolderEntry> batch;  // found since the last scan_folder_poll()
+    mutex mtx;
+    atomic<bool> done, stop;  // set by the worker / the main thread, read by the other
+    thread worker;
+    int divisor;
+
+    FolderScan(const string &root, const string &pattern, int _divisor) : done(false), stop(false), divisor(_divisor)
+    {
+        worker = thread([this, root, pattern]()
+        {
+            WalkFolder(root, "", pattern.c_str(), [this](FolderEntry &e)
+            {
+                lock_guard<mutex> lock(mtx);
+                batch.push_back(e);
+            }, stop);
+            lock_guard<mutex> lock(mtx);
+            done = true;
+        });
+    }
+
+    ~FolderScan()
+    {
+        stop = true;
+        worker.join();
+    }
+};
+
+IntResourceManagerCompact<FolderScan> folderscans([](FolderScan *fs) { delete fs; });
+
 void AddFileOps()
 {
     STARTDECL(scan_folder) (Value &fld, Value &divisor)
@@ -118,6 +376,57 @@ void AddFileOps()
         " Specify 1 as divisor to get sizes in bytes, 1024 for kb etc. Values > 0x7FFFFFFF will be clamped."
         " Returns nil if folder couldn't be scanned.");
 
+    STARTDECL(scan_folder_recursive) (Value &fld, Value &pattern, Value &divisor)
+    {
+        auto root = FolderRoot(fld);
+        string pat = pattern.type == V_STRING ? pattern.sval->str() : "*";
+        fld.DEC();
+        pattern.DEC();
+        vector<FolderEntry> entries;
+        atomic<bool> stop(false);
+        WalkFolder(root, "", pat.c_str(), [&](FolderEntry &e) { entries.push_back(e); }, stop);
+        return FolderEntryVectors(entries, divisor.ival);
+    }
+    ENDDECL3(scan_folder_recursive, "folder,pattern,divisor", "Ssi", "S]I]I]I]",
+        "returns four vectors for all files in folder and all its sub-folders whose name matches pattern"
+        " (which may use * and ?, default is all files): the paths relative to folder (using / as separator),"
+        " the sizes (in bytes divided by divisor, clamped to 0x7FFFFFFF, pass e.g. 1024 for files of 2GB or more),"
+        " the modification times (in seconds since 1970), and the high parts of those times, which are 0 until"
+        " 2038: the full time is time + high * 0x80000000. files whose size and time can't be determined are"
+        " included with a size of -1 and a time of 0.");
+
+    STARTDECL(scan_folder_async) (Value &fld, Value &pattern, Value &divisor)
+    {
+        auto root = FolderRoot(fld);
+        string pat = pattern.type == V_STRING ? pattern.sval->str() : "*";
+        fld.DEC();
+        pattern.DEC();
+        return Value((int)folderscans.Add(new FolderScan(root, pat, divisor.ival)));
+    }
+    ENDDECL3(scan_folder_async, "folder,pattern,divisor", "Ssi", "I",
+        "like scan_folder_recursive(), but scans on a background thread. returns a handle to pass to"
+        " scan_folder_poll().");
+
+    STARTDECL(scan_folder_poll) (Value &h)
+    {
+        auto fs = folderscans.Get(h.ival);
+        if (!fs) g_vm->BuiltinError("scan_folder_poll: invalid handle");
+        vector<FolderEntry> batch;
+        bool done;
+        {
+            lock_guard<mutex> lock(fs->mtx);
+            batch.swap(fs->batch);
+            done = fs->done;
+        }
+        auto divisor = fs->divisor;
+        if (done) folderscans.Delete(h.ival);
+        g_vm->Push(FolderEntryVectors(batch, divisor));
+        return Value(done);
+    }
+    ENDDECL1(scan_folder_poll, "h", "I", "S]I]I]I]I",
+        "returns the files found by a scan_folder_async() since the last call, in the same four vectors as"
+        " scan_folder_recursive(), and whether the scan has finished. once it has, the handle is no longer valid.");
+
     STARTDECL(read_file) (Value &file)
     {
         size_t sz = 0;
@@ -132,6 +441,43 @@ void AddFileOps()
         "returns the contents of a file as a string, or nil if the file can't be found."
         " you may use either \\ or / as path separators");
 
+    STARTDECL(load_file_async) (Value &file)
+    {
+        LoadFileAsync(file.sval->str());
+        file.DEC();
+        return Value();
+    }
+    ENDDECL1(load_file_async, "file", "S", "",
+        "starts loading a file on a background thread. once file_loaded_async() says it is done, anything that"
+        " loads this file next (read_file(), gl_newmesh_iqm(), play_wav(), gl_setfontname() etc.) takes it from"
+        " memory instead of waiting for the disk. if it is loaded before then, it waits for the background load.");
+
+    STARTDECL(file_loaded_async) (Value &file)
+    {
+        auto done = FileLoadedAsync(file.sval->str());
+        file.DEC();
+        return Value(done);
+    }
+    ENDDECL1(file_loaded_async, "file", "S", "I",
+        "returns whether a file started with load_file_async() has finished loading (or failed to),"
+        " or was never started. poll this every frame, e.g. from a coroutine.");
+
+    STARTDECL(mmap_file) (Value &file)
+    {
+        auto fn = FindFile(file.sval->str());
+        file.DEC();
+        if (fn.empty()) return Value(0, V_NIL);
+        int len = -1;
+        auto p = MapFile(fn, len);
+        if (!p) return len ? Value(0, V_NIL) : Value(g_vm->NewString("", 0));
+        return Value(g_vm->NewExternalString(p, len, UnmapFile));
+    }
+    ENDDECL1(mmap_file, "file", "S", "S?",
+        "returns the contents of a file as a string like read_file(), except the file is mapped into memory rather"
+        " than read, so only the parts you actually access get loaded. use substring() and the string scanning"
+        " functions on it to avoid copies. the file is unmapped once no strings refer to it anymore."
+        " returns nil if the file can't be found or mapped (e.g. because it is 2GB or more, use file_open() instead).");
+
     STARTDECL(write_file) (Value &file, Value &contents)
     {
         FILE *f = OpenForWriting(file.sval->str(), true);
@@ -145,8 +491,108 @@ void AddFileOps()
         contents.DEC();
         return Value(written == 1);
     }
-    ENDDECL2(write_file, "file,contents", "SS", "I",
+    ENDDECL2(write_file, "file,contents", "SS&", "I",
         "creates a file with the contents of a string, returns false if writing wasn't possible");
+
+    STARTDECL(write_dir) ()
+    {
+        return Value(g_vm->NewString(WriteDir()));
+    }
+    ENDDECL0(write_dir, "", "", "S",
+        "returns the folder write_file() and file_open() write to (empty, or ending in a separator). the scan_folder"
+        " functions take paths relative to the current folder instead, so prefix with this to scan what you wrote.");
+
+    STARTDECL(file_open) (Value &file, Value &mode)
+    {
+        ValueRef fref(file), mref(mode);
+        FILE *f = nullptr;
+        string m = mode.sval->str();
+        if (m == "r")
+        {
+            auto fn = FindFile(file.sval->str());
+            if (!fn.empty()) f = fopen(fn.c_str(), "rb");
+        }
+        else if (m == "w" || m == "a")
+        {
+            f = OpenForWriting(file.sval->str(), true, m == "a");
+        }
+        else
+        {
+            g_vm->BuiltinError("file_open: mode must be \"r\", \"w\" or \"a\"");
+        }
+        return Value(f ? (int)openfiles.Add(f) : 0);
+    }
+    ENDDECL2(file_open, "file,mode", "SS", "I",
+        "opens a file for reading (mode \"r\"), writing (\"w\", which empties the file first) or appending (\"a\")."
+        " returns a handle to pass to the other file_ functions, or 0 if the file can't be opened."
+        " unlike read_file(), this lets you process files bigger than what fits in memory.");
+
+    STARTDECL(file_close) (Value &h)
+    {
+        GetFile(h, "file_close");
+        openfiles.Delete(h.ival);
+        return Value();
+    }
+    ENDDECL1(file_close, "h", "I", "",
+        "closes a file opened with file_open(). any files still open are closed when the program ends.");
+
+    STARTDECL(file_read_line) (Value &h)
+    {
+        auto f = GetFile(h, "file_read_line");
+        readbuf.clear();
+        // a byte at a time rather than fgets(), which can't tell us about NUL bytes in the line
+        int c;
+        while ((c = getc(f)) != EOF && c != '\n') readbuf.push_back((char)c);
+        if (c == EOF && readbuf.empty()) return Value(0, V_NIL);
+        if (readbuf.size() && readbuf.back() == '\r') readbuf.pop_back();
+        return Value(g_vm->NewString(readbuf));
+    }
+    ENDDECL1(file_read_line, "h", "I", "S?",
+        "reads the next line from a file, without its \\n or \\r\\n line ending. returns nil at the end of the file.");
+
+    STARTDECL(file_read_bytes) (Value &h, Value &n)
+    {
+        auto f = GetFile(h, "file_read_bytes");
+        if (n.ival <= 0) return Value(g_vm->NewString("", 0));
+        readbuf.resize(n.ival);
+        auto len = fread(&readbuf[0], 1, n.ival, f);
+        if (!len) return Value(0, V_NIL);
+        return Value(g_vm->NewString(readbuf.c_str(), (int)len));
+    }
+    ENDDECL2(file_read_bytes, "h,n", "II", "S?",
+        "reads up to n bytes from a file, fewer only if the end of the file is reached."
+        " returns nil if there was nothing left to read.");
+
+    STARTDECL(file_write) (Value &h, Value &s)
+    {
+        ValueRef sref(s);
+        auto f = GetFile(h, "file_write");
+        return Value(!s.sval->len || fwrite(s.sval->str(), s.sval->len, 1, f) == 1);
+    }
+    ENDDECL2(file_write, "h,s", "IS&", "I",
+        "writes a string to a file opened for writing or appending, returns false if writing wasn't possible.");
+
+    STARTDECL(file_seek) (Value &h, Value &pos, Value &fromend, Value &high)
+    {
+        auto f = GetFile(h, "file_seek");
+        auto offset = (int64_t)high.ival * 0x80000000LL + pos.ival;
+        return Value(FileSeek(f, offset, fromend.True() ? SEEK_END : SEEK_SET));
+    }
+    ENDDECL4(file_seek, "h,pos,fromend,high", "IIii", "I",
+        "moves the read/write position in a file to pos bytes from the start, or if fromend is true, from the end"
+        " (use a negative pos). for positions of 2GB or more, pass high too, to seek to pos + high * 0x80000000,"
+        " e.g. the two values file_tell() returns. returns false if that wasn't possible.");
+
+    STARTDECL(file_tell) (Value &h)
+    {
+        auto pos = FileTell(GetFile(h, "file_tell"));
+        g_vm->Push(Value((int)(pos % 0x80000000LL)));
+        return Value((int)(pos / 0x80000000LL));
+    }
+    ENDDECL1(file_tell, "h", "I", "II",
+        "returns the current read/write position in a file. this is two values, pos and high, where the position"
+        " is pos + high * 0x80000000, so it can go past 2GB. high is 0 for positions under that, so it can"
+        " usually be ignored.");
 }
 
 AutoRegister __afo("file", AddFileOps);
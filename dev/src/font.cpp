@@ -31,7 +31,7 @@ map<string, OutlineFont *> loadedfaces;
 OutlineFont *curface = nullptr;
 string curfacename;
 
-Shader *texturedshader = nullptr;
+Shader *fontshader = nullptr;
 
 void CullFonts()
 {
@@ -40,6 +40,7 @@ void CullFonts()
         if (it->second->usedcount)
         {
             it->second->usedcount = 0;
+            it->second->CullTextCache();
             it++;
         }
         else
@@ -81,8 +82,8 @@ void AddFont()
             return Value(true);
         }
 
-        texturedshader = LookupShader("textured");
-        assert(texturedshader);
+        fontshader = LookupShader("font");
+        assert(fontshader);
 
         curface = LoadFont(piname.c_str());
         if (curface) 
@@ -126,7 +127,8 @@ void AddFont()
     }
     ENDDECL1(gl_setfontsize, "size", "I", "I",
         "sets the font for rendering into this fontsize (in pixels). caches into a texture first time this size is"
-        " used, flushes from cache if this size is not used an entire frame. font rendering will look best if using"
+        " used, flushes from cache if this size is not used an entire frame. the text itself is cached too, so"
+        " rendering the same string again in the next frame is cheap. font rendering will look best if using"
         " 1:1 pixels (careful with gl_scale/gl_translate). returns true if success");
 
     STARTDECL(gl_setmaxfontsize) (Value &fontsize)
@@ -155,9 +157,7 @@ void AddFont()
             object2view *= scaling(curfontsize / float(maxfontsize));
         }
 
-        SetTexture(0, f->texid);
-		texturedshader->Set();
-        f->RenderText(s.sval->str());
+        f->RenderText(s.sval->str(), fontshader);
 
         if (curfontsize > maxfontsize) object2view = oldobject2view;
 
@@ -32,10 +32,36 @@ struct OutlineFont
 
 struct BitmapFont
 {
+    struct Glyph
+    {
+        int2 atlaspos;  // top left of its bitmap in the atlas
+        int2 size;      // of the bitmap, 0 for e.g. a space
+        int2 offset;    // of the bitmap from the pen position, which is at the top of the line
+        int advance;
+    };
+
+    // glyphs sharing a row in the atlas, filled left to right
+    struct Shelf
+    {
+        int y, height, x;
+    };
+
+    // a string rendered recently, which once rendered again is laid out and uploaded to a VBO, so from then on
+    // rendering it is a single draw call
+    struct TextMesh
+    {
+        Mesh *mesh;  // null if not built yet or if there's nothing visible
+        bool built;
+        bool used;
+    };
+
     uint texid;
-    vector<int3> positions;  
-    int height;
-    size_t texh, texw;
+    vector<Glyph> glyphs;  // in the order of font->unicodetable
+    int height, ascent;
+    int texh, texw;
+    vector<uchar> atlas;  // copy of the (alpha only) texture, so it can grow
+    vector<Shelf> shelves;
+    unordered_map<string, TextMesh> textcache;
     int usedcount;
 
     int size;
@@ -45,10 +71,18 @@ struct BitmapFont
     ~BitmapFont();
     BitmapFont(OutlineFont *_font, int _size);
 
-    void RenderText(const char *text);
+    void RenderText(const char *text, Shader *sh);
     const int2 TextSize(const char *text);
 
     bool CacheChars(const char *text);
+
+    void ClearTextCache();
+    void CullTextCache();  // removes text not rendered since the last call
+
+    private:
+
+    bool PlaceGlyph(const int2 &sz, int2 &pos);
+    void LayoutText(const char *text);
 };
 
 extern OutlineFont *LoadFont(const char *name);
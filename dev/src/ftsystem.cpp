@@ -23,153 +23,226 @@
 
 BitmapFont::~BitmapFont()
 {
+    ClearTextCache();
     if (texid) DeleteTexture(texid);
 }
 
-BitmapFont::BitmapFont(OutlineFont *_font, int _size) : texid(0), usedcount(1), font(_font), size(_size)
+BitmapFont::BitmapFont(OutlineFont *_font, int _size)
+    : texid(0), height(0), ascent(0), texh(0), texw(0), usedcount(1), size(_size), font(_font)
 {
 }
 
+// empty pixels around each glyph, so filtering doesn't pick up its neighbours
+const int atlasmargin = 2;
+
+// Shelf packing: a glyph goes on the shelf with the least height to spare (but not too much, so small glyphs don't
+// use up room meant for tall ones), or otherwise starts a new shelf, growing the atlas downwards if needed.
+// sz includes the margin.
+bool BitmapFont::PlaceGlyph(const int2 &sz, int2 &pos)
+{
+    Shelf *best = nullptr;
+    for (auto &s : shelves)
+    {
+        if (s.height >= sz.y() && s.height <= sz.y() * 4 / 3 + 2 && s.x + sz.x() <= texw &&
+            (!best || s.height < best->height))
+            best = &s;
+    }
+
+    if (!best)
+    {
+        int y = shelves.empty() ? atlasmargin : shelves.back().y + shelves.back().height;
+        if (y + sz.y() > texh)
+        {
+            int newh = max(texh, 128);
+            while (newh < y + sz.y()) newh *= 2;
+            if (newh > MaxTextureSize()) return false;
+            texh = newh;
+            // rows are added at the end, so everything already in the atlas stays where it is
+            atlas.resize(texw * texh, 0);
+        }
+        Shelf s = { y, sz.y(), atlasmargin };
+        shelves.push_back(s);
+        best = &shelves.back();
+    }
+
+    pos = int2(best->x, best->y);
+    best->x += sz.x();
+    return true;
+}
+
+// Renders any glyphs in text not seen before into the atlas. Only the rows they went into are uploaded again, unless
+// the atlas had to grow, which needs a new texture.
 bool BitmapFont::CacheChars(const char *text)
 {
     usedcount++;
 
     font->EnsureCharsPresent(text);
 
-    if (positions.size() == font->unicodetable.size())
+    if (glyphs.size() == font->unicodetable.size())
         return true;
 
-    if (texid) DeleteTexture(texid);
-    positions.clear();
-
-    if (FT_Set_Pixel_Sizes((FT_Face)font->fthandle, 0, size))
-        return false;
-
+    // the face is shared between all sizes
     auto face = (FT_Face)font->fthandle;
-    const size_t margin = 3;
-    texh = 0;
-    texw = MaxTextureSize();
-
-    int max_descent = 0, max_ascent = 0;
-    size_t space_on_line = texw - margin, lines = 1;
+    if (FT_Set_Pixel_Sizes(face, 0, size))
+        return false;
 
-    for (int i : font->unicodetable)
+    if (!texw)
     {
-        size_t char_index = FT_Get_Char_Index(face, i);
+        // from the font rather than from the glyphs seen so far, so it doesn't change as more get added
+        ascent = (face->size->metrics.ascender + 63) >> 6;
+        height = ascent + ((-face->size->metrics.descender + 63) >> 6);
+        texw = min(MaxTextureSize(), 2048);
+    }
 
-        FT_Load_Glyph(face, char_index, FT_LOAD_DEFAULT);
-        FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);    //FIXME: can we avoid doing this twice?
+    int oldtexh = texh;
+    int dirtymin = texh, dirtymax = 0;
+    bool ok = true;
 
-        size_t advance = (face->glyph->metrics.horiAdvance >> 6) + margin;
+    while (glyphs.size() < font->unicodetable.size())
+    {
+        Glyph g;
+        g.atlaspos = g.size = g.offset = int2_0;
+        g.advance = 0;
 
-        if (advance > space_on_line)
+        if (!FT_Load_Char(face, font->unicodetable[glyphs.size()], FT_LOAD_RENDER))
         {
-            space_on_line = texw - margin;
-            ++lines;
-        }
-        space_on_line -= advance;
+            auto &bm = face->glyph->bitmap;
+            g.size = int2(min((int)bm.width, texw - atlasmargin * 2), (int)bm.rows);
+            g.offset = int2(face->glyph->bitmap_left, ascent - face->glyph->bitmap_top);
+            g.advance = face->glyph->metrics.horiAdvance >> 6;
 
-        max_ascent = max(face->glyph->bitmap_top, max_ascent);
-        max_descent = max(face->glyph->bitmap.rows - face->glyph->bitmap_top, max_descent);
-    }
-
-    height = max_ascent + max_descent;
+            if (g.size.x() > 0 && g.size.y() > 0)
+            {
+                if (!PlaceGlyph(g.size + int2(atlasmargin), g.atlaspos)) { ok = false; break; }
 
-    size_t needed_image_height = (max_ascent + max_descent + margin) * lines + margin;
-    texh = 1;
-    while (texh < needed_image_height)
-        texh *= 2;
+                for (int row = 0; row < g.size.y(); row++)
+                    memcpy(&atlas[(g.atlaspos.y() + row) * texw + g.atlaspos.x()], bm.buffer + row * bm.pitch,
+                           g.size.x());
 
-    uchar* image = new uchar[texh * texw * 4];
-    memset(image, 0, texh * texw * 4);
+                dirtymin = min(dirtymin, g.atlaspos.y());
+                dirtymax = max(dirtymax, g.atlaspos.y() + g.size.y());
+            }
+        }
 
-    size_t x = margin, y = margin + max_ascent;
+        glyphs.push_back(g);
+    }
 
-    for (int i : font->unicodetable)
+    if (texh != oldtexh)
+    {
+        // text meshes refer to the old texture, and have texture coordinates for its size
+        ClearTextCache();
+        if (texid) DeleteTexture(texid);
+        texid = CreateTexture(atlas.data(), texw, texh, true, false, true);
+    }
+    else if (dirtymin < dirtymax)
     {
-        size_t char_index = FT_Get_Char_Index(face, i);
+        UpdateTexture(texid, 0, dirtymin, texw, dirtymax - dirtymin, &atlas[dirtymin * texw], true);
+    }
 
-        FT_Load_Glyph(face, char_index, FT_LOAD_DEFAULT);
-        FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+    return ok;
+}
 
-        size_t advance = (face->glyph->metrics.horiAdvance >> 6) + margin;
-        if (advance > texw - x)
-        {
-            x = margin;
-            y += (max_ascent + max_descent + margin);
-        }
+struct TextVert { float3 p; float2 t; };
 
-        positions.push_back(int3(x, y - max_ascent, advance - margin));
+// reused between calls, so text drawn without a mesh doesn't allocate
+static vector<TextVert> textverts;
+static vector<int> textindices;
 
-        for (int row = 0; row < face->glyph->bitmap.rows; ++row)
+void BitmapFont::LayoutText(const char *text)
+{
+    textverts.clear();
+    textindices.clear();
+    float2 texsize = float2(float(texw), float(texh));
+    int x = 0;
+
+    for (;;)
+    {
+        int c = FromUTF8(text);
+        if (c <= 0) break;
+        auto &g = glyphs[font->unicodemap[c]];
+        if (g.size.x() > 0)
         {
-            for (int pixel = 0; pixel < face->glyph->bitmap.width; ++pixel)
-            {
-                auto p = image + ((x + face->glyph->bitmap_left + pixel) +
-                                    (y - face->glyph->bitmap_top + row) * texw) * 4;
-                *p++ = 0xFF;    // FIXME: wastefull
-                *p++ = 0xFF;
-                *p++ = 0xFF;
-                *p++ = face->glyph->bitmap.buffer[pixel + row * face->glyph->bitmap.pitch];
-            }
+            auto t1 = float2(g.atlaspos) / texsize;
+            auto t2 = float2(g.atlaspos + g.size) / texsize;
+            auto p1 = float2(g.offset + int2(x, 0));
+            auto p2 = p1 + float2(g.size);
+            int j = (int)textverts.size();
+            TextVert v;
+            v.t = t1;                     v.p = float3(p1.x(), p1.y(), 0); textverts.push_back(v);
+            v.t = float2(t1.x(), t2.y()); v.p = float3(p1.x(), p2.y(), 0); textverts.push_back(v);
+            v.t = t2;                     v.p = float3(p2.x(), p2.y(), 0); textverts.push_back(v);
+            v.t = float2(t2.x(), t1.y()); v.p = float3(p2.x(), p1.y(), 0); textverts.push_back(v);
+            int quad[] = { j + 0, j + 1, j + 2, j + 2, j + 3, j + 0 };
+            textindices.insert(textindices.end(), quad, quad + 6);
         }
-
-        x += advance;
+        x += g.advance;
     }
-
-    texid = CreateTexture(image, texw, texh, true, false);
-
-    delete[] image;
-
-    return true;
 }
 
-void BitmapFont::RenderText(const char *text)
+// Text only gets a mesh once it is rendered again in the same or the next frame. Text that changes every frame
+// (counters, timers) is drawn from client memory instead, so it doesn't create and delete buffers every frame.
+void BitmapFont::RenderText(const char *text, Shader *sh)
 {
     if (!CacheChars(text))
         return;
 
-    struct PT { float3 p; float2 t; };
+    auto it = textcache.find(text);
+    if (it == textcache.end())
+    {
+        TextMesh tm = { nullptr, false, false };
+        it = textcache.insert(make_pair(string(text), tm)).first;
+    }
+    else if (!it->second.built)
+    {
+        LayoutText(text);
+        if (textverts.size())
+        {
+            auto m = new Mesh(new Geometry(textverts.data(), (int)textverts.size(), sizeof(TextVert), "PT"));
+            auto surf = new Surface(textindices.data(), (int)textindices.size());
+            surf->textures[0] = texid;
+            m->surfs.push_back(surf);
+            it->second.mesh = m;
+        }
+        it->second.built = true;
+    }
 
-    int len = StrLenUTF8(text);
-    if (len <= 0)
+    auto &tm = it->second;
+    tm.used = true;
+    if (tm.built)
+    {
+        if (tm.mesh) tm.mesh->Render(sh);
         return;
+    }
 
-    auto vbuf = new PT[len * 4];
-    auto ibuf = new int[len * 6];
-
-    auto x = 0.0f;
-    auto y = 0.0f;
-    float fontheighttex = height / float(texh);
+    LayoutText(text);
+    if (textverts.empty())
+        return;
+    sh->Set();
+    SetTexture(0, texid);
+    RenderArray(PRIM_TRIS, (int)textindices.size(), "PT", sizeof(TextVert), textverts.data(), textindices.data());
+}
 
-    auto idx = ibuf;
+void BitmapFont::ClearTextCache()
+{
+    for (auto &e : textcache) delete e.second.mesh;
+    textcache.clear();
+}
 
-    for (int i = 0; i < len; i++)
+void BitmapFont::CullTextCache()
+{
+    for (auto it = textcache.begin(); it != textcache.end(); )
     {
-        int c = FromUTF8(text);
-        int3 &pos = positions[font->unicodemap[c]];
-        float x1 = pos.x() / float(texw);
-        float x2 = (pos.x() + pos.z()) / float(texw);
-        float y1 = pos.y() / float(texh);
-        float advance = float(pos.z());
-        int j = i * 4;
-        auto &v0 = vbuf[j + 0]; v0.t = float2(x1, y1                ); v0.p = float3(x,           y,          0);
-        auto &v1 = vbuf[j + 1]; v1.t = float2(x1, y1 + fontheighttex); v1.p = float3(x,           y + height, 0);
-        auto &v2 = vbuf[j + 2]; v2.t = float2(x2, y1 + fontheighttex); v2.p = float3(x + advance, y + height, 0);
-        auto &v3 = vbuf[j + 3]; v3.t = float2(x2, y1                ); v3.p = float3(x + advance, y,          0);
-        *idx++ = j + 0;
-        *idx++ = j + 1;
-        *idx++ = j + 2;
-        *idx++ = j + 2;
-        *idx++ = j + 3;
-        *idx++ = j + 0;
-        x += advance;
+        if (it->second.used)
+        {
+            it->second.used = false;
+            it++;
+        }
+        else
+        {
+            delete it->second.mesh;
+            it = textcache.erase(it);
+        }
     }
-
-    RenderArray(PRIM_TRIS, len * 6, "PT", sizeof(PT), vbuf, ibuf);
-
-    delete[] ibuf;
-    delete[] vbuf;
 }
 
 const int2 BitmapFont::TextSize(const char *text)
@@ -182,8 +255,7 @@ const int2 BitmapFont::TextSize(const char *text)
     {
         int c = FromUTF8(text);
         if (c <= 0) return int2(x, height);
-        x += positions[font->unicodemap[c]].z();
-
+        x += glyphs[font->unicodemap[c]].advance;
     }
 }
 
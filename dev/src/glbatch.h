@@ -0,0 +1,141 @@
+// Copyright 2014 Wouter van Oortmerssen. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Batching for the immediate mode 2D primitives (gl_rect / gl_line / gl_circle / gl_polygon).
+// Needs glinterface.h, but not GL itself: drawing goes through a function passed in, so the batching can be tested
+// with one that just records what it gets.
+
+// The state that is applied when a batch is drawn, rather than when the primitive is added (the shader's uniforms).
+// Primitives only go in the same batch if this is the same. Everything else (blending, textures, projection) is GL
+// state that is set right away, so whatever changes it must call Flush() first.
+struct BatchState
+{
+    Shader *shader;
+    float4 color;
+    Primitive prim;  // PRIM_TRIS or PRIM_LINES
+
+    bool operator==(const BatchState &o) const { return shader == o.shader && color == o.color && prim == o.prim; }
+};
+
+struct BatchStats
+{
+    int drawcalls, primitives, verts;
+};
+
+class Batcher
+{
+    public:
+
+    typedef function<void(const BatchState &state, const vector<BasicVert> &verts, const vector<int> &indices)> DrawFun;
+
+    private:
+
+    DrawFun draw;
+    BatchState state;
+    vector<BasicVert> verts, drawverts;
+    vector<int> indices, drawindices;
+    BatchStats stats;
+
+    public:
+
+    Batcher(const DrawFun &_draw) : draw(_draw)
+    {
+        state.shader = nullptr;
+        state.color = float4_0;
+        state.prim = PRIM_TRIS;
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    // Adds a polygon, as a fan of triangles or as a loop of lines depending on s.prim. The verts are used as is, so
+    // positions must already be in the space the batch is drawn in. Primitives are never reordered, since 2D
+    // rendering depends on the order things are drawn in, so only consecutive ones with the same state are merged.
+    void Add(const BatchState &s, const BasicVert *v, int n)
+    {
+        if (!(s == state)) Flush();
+        state = s;
+        auto base = (int)verts.size();
+        verts.insert(verts.end(), v, v + n);
+        if (s.prim == PRIM_TRIS)
+        {
+            for (int i = 1; i < n - 1; i++)
+            {
+                indices.push_back(base);
+                indices.push_back(base + i);
+                indices.push_back(base + i + 1);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < n; i++)
+            {
+                indices.push_back(base + i);
+                indices.push_back(base + (i + 1) % n);
+            }
+        }
+        stats.primitives++;
+    }
+
+    void Flush()
+    {
+        if (indices.empty()) return;
+        // the draw function ends up calling Flush() again (through Shader::Set()), so empty the batch first
+        drawverts.swap(verts);
+        drawindices.swap(indices);
+        verts.clear();
+        indices.clear();
+        stats.drawcalls++;
+        stats.verts += (int)drawverts.size();
+        draw(state, drawverts, drawindices);
+    }
+
+    // Draws what's left, and returns the stats since the last call.
+    BatchStats EndFrame()
+    {
+        Flush();
+        auto s = stats;
+        memset(&stats, 0, sizeof(stats));
+        return s;
+    }
+};
+
+// A DrawFun that records what the batcher draws instead of drawing it, so the batching can be tested without GL.
+struct BatchRecorder
+{
+    struct Call
+    {
+        BatchState state;
+        int verts, indices;
+    };
+
+    vector<Call> calls;
+
+    Batcher::DrawFun Fun()
+    {
+        return [this](const BatchState &state, const vector<BasicVert> &verts, const vector<int> &indices)
+        {
+            Call c = { state, (int)verts.size(), (int)indices.size() };
+            calls.push_back(c);
+        };
+    }
+};
+
+// The batcher the gl_ functions use (in glgeom.cpp), drawing in view space.
+// Takes verts in object space (using object2view), and prim as in polymode (PRIM_FAN or PRIM_LOOP).
+extern void RenderBatched(Shader *sh, Primitive prim, BasicVert *verts, int n);
+extern BatchStats EndBatchFrame();
+
+#ifdef _DEBUG
+// checks Batcher against a BatchRecorder, returns what went wrong or "" (in glgeom.cpp)
+extern string BatchSelfTest();
+#endif
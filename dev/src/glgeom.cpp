@@ -15,6 +15,7 @@
 #include "stdafx.h"
 #include "glinterface.h"
 #include "glincludes.h"
+#include "glbatch.h"
 
 void SetAttribs(uint vbo, const char *fmt, int vertsize1, char *buf1 = nullptr, int vertsize2 = 0, char *buf2 = nullptr)
 {
@@ -137,6 +138,7 @@ Mesh::~Mesh()
 
 void SetPointSprite(float size)
 {
+    FlushBatch();
     #ifdef PLATFORM_MOBILE
         // glEnable(GL_POINT_SPRITE_OES);
         // glTexEnvi(GL_POINT_SPRITE_OES, GL_COORD_REPLACE_OES, GL_TRUE);
@@ -158,6 +160,7 @@ GLenum GetPrimitive(Primitive prim)
         case PRIM_FAN:   return GL_TRIANGLE_FAN;
         case PRIM_LOOP:  return GL_LINE_LOOP;
         case PRIM_POINT: return GL_POINTS;
+        case PRIM_LINES: return GL_LINES;
     }
 }
 
@@ -187,3 +190,93 @@ void RenderLine3D(const float3 &v1, const float3 &v2, const float3 &campos, floa
     RenderLine(PRIM_FAN, v1, v2, side);
 }
 
+
+// The verts are in view space already, so draw with an identity object transform. Lights are stored in view space,
+// and the camera is at its origin, so lighting comes out the same.
+Batcher batcher([](const BatchState &s, const vector<BasicVert> &verts, const vector<int> &indices)
+{
+    auto o2v = object2view, v2o = view2object;
+    auto col = curcolor;
+    object2view = view2object = float4x4_1;
+    curcolor = s.color;
+    s.shader->Set();
+    RenderArray(s.prim, (int)indices.size(), "PNTC", sizeof(BasicVert), (void *)&verts[0], (int *)&indices[0]);
+    object2view = o2v;
+    view2object = v2o;
+    curcolor = col;
+});
+
+void RenderBatched(Shader *sh, Primitive prim, BasicVert *verts, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        verts[i].pos = (object2view * float4(verts[i].pos, 1)).xyz();
+        verts[i].norm = (object2view * float4(verts[i].norm, 0)).xyz();
+    }
+    BatchState s = { sh, curcolor, prim == PRIM_LOOP ? PRIM_LINES : PRIM_TRIS };
+    batcher.Add(s, verts, n);
+}
+
+void FlushBatch() { batcher.Flush(); }
+BatchStats EndBatchFrame() { return batcher.EndFrame(); }
+
+#ifdef _DEBUG
+// Runs the batching logic against a BatchRecorder. Returns what went wrong, or "" if nothing did.
+string BatchSelfTest()
+{
+    BatchRecorder rec;
+    Batcher b(rec.Fun());
+    Shader sh1, sh2;  // never compiled or set, they only need to be different shaders
+    BatchState s = { &sh1, float4(1), PRIM_TRIS };
+    BasicVert quad[4];
+    for (auto &v : quad) { v.pos = v.norm = float3(0.0f); v.tc = float2(0.0f); v.col = byte4((uchar)0); }
+
+    for (int i = 0; i < 5000; i++) b.Add(s, quad, 4);
+    auto stats = b.EndFrame();
+    if (rec.calls.size() != 1 || stats.drawcalls != 1 || stats.primitives != 5000)
+        return "5000 rects with the same state should be 1 draw call";
+    if (rec.calls[0].verts != 20000 || rec.calls[0].indices != 30000)
+        return "rects should be 4 verts and 2 triangles each";
+
+    rec.calls.clear();
+    auto red = s, line = s, other = s;
+    red.color = float4(1, 0, 0, 1);
+    line.prim = PRIM_LINES;
+    other.shader = &sh2;
+    b.Add(s, quad, 4);
+    b.Add(red, quad, 4);
+    b.Add(red, quad, 4);
+    b.Add(other, quad, 4);
+    b.Add(line, quad, 4);
+    b.Add(s, quad, 4);
+    b.Flush();  // what changing e.g. a texture does
+    b.Add(s, quad, 4);
+    stats = b.EndFrame();
+    if (rec.calls.size() != 6 || stats.drawcalls != 6 || stats.primitives != 7)
+        return "changing color, shader or mode, or flushing, should start a new draw call";
+    if (!(rec.calls[1].state == red) || rec.calls[1].indices != 12 || !(rec.calls[2].state == other))
+        return "each batch should be drawn with its own state";
+    if (rec.calls[3].state.prim != PRIM_LINES || rec.calls[3].indices != 8)
+        return "a line loop of 4 verts should be 4 lines";
+
+    stats = b.EndFrame();
+    if (rec.calls.size() != 6 || stats.drawcalls || stats.primitives)
+        return "an empty frame should draw nothing";
+
+    // drawing calls Shader::Set(), which flushes, so the draw function must be able to flush without drawing twice
+    int draws = 0;
+    Batcher *reentrant = nullptr;
+    Batcher rb([&](const BatchState &, const vector<BasicVert> &, const vector<int> &)
+    {
+        draws++;
+        reentrant->Flush();
+    });
+    reentrant = &rb;
+    rb.Add(s, quad, 4);
+    rb.EndFrame();
+    if (draws != 1)
+        return "flushing from within the draw function should not draw again";
+
+    return "";
+}
+#endif
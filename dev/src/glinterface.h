@@ -104,7 +104,7 @@ struct Light
 
 
 enum BlendMode { BLEND_NONE = 0, BLEND_ALPHA, BLEND_ADD, BLEND_ADDALPHA, BLEND_MUL };
-enum Primitive { PRIM_TRIS, PRIM_FAN, PRIM_LOOP, PRIM_POINT };
+enum Primitive { PRIM_TRIS, PRIM_FAN, PRIM_LOOP, PRIM_POINT, PRIM_LINES };
 
 
 extern void OpenGLInit();
@@ -119,8 +119,21 @@ extern string LoadMaterialFile(const char *mfile);
 extern Shader *LookupShader(const char *name);
 extern void ShaderShutDown();
 
-extern uint CreateTexture(uchar *buf, int x, int y, bool clamp = false, bool mipmap = true);
+// alphaonly: buf has 1 byte per pixel, which ends up in the alpha channel (the rgb read as 0)
+extern uint CreateTexture(uchar *buf, int x, int y, bool clamp = false, bool mipmap = true, bool alphaonly = false);
+// replaces the w * h pixels at x, y (a tightly packed buf, in the same format the texture was created with)
+extern void UpdateTexture(uint id, int x, int y, int w, int h, uchar *buf, bool alphaonly = false);
 extern uint CreateTextureFromFile(const char *name);
+// like CreateTextureFromFile(), but shares the texture if the same name is already loaded. each call adds a
+// reference, that ReleaseTexture() takes away again
+extern uint LoadTexture(const char *name);
+// deletes the texture, or for ones from LoadTexture(), once its last reference is released
+extern void ReleaseTexture(uint id);
+// forgets all LoadTexture() textures, without deleting them (for when the context goes away)
+extern void TextureCacheClear();
+// decodes a texture file on a worker thread, the next CreateTextureFromFile() of it then only has to upload it
+extern void LoadTextureAsync(const char *name);
+extern bool TextureLoadedAsync(const char *name);
 extern void DeleteTexture(uint id);
 extern void SetTexture(uint textureunit, uint id);
 extern int MaxTextureSize();
@@ -129,6 +142,8 @@ extern void RenderArray(Primitive prim, int count, const char *fmt,
                         int vertsize, void *vbuf1, int *ibuf = nullptr, int vertsize2 = 0, void *vbuf2 = nullptr);
 extern void RenderLine(Primitive prim, const float3 &v1, const float3 &v2, const float3 &side);
 extern void RenderLine3D(const float3 &v1, const float3 &v2, const float3 &campos, float thickness);
+// draws any batched 2D primitives (see glbatch.h), call before changing GL state
+extern void FlushBatch();
 
 extern Mesh *LoadIQM(const char *filename);
 
@@ -260,6 +260,9 @@ Shader::~Shader()
 
 void Shader::Set()
 {
+    // anything rendering with a shader goes through here, so that is the point batched primitives must be drawn
+    FlushBatch();
+
     glUseProgram(program);
 
     if (mvp_i >= 0) glUniformMatrix4fv(mvp_i, 1, false, view2clip * object2view);
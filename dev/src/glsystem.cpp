@@ -36,6 +36,7 @@ int SetBlendMode(BlendMode mode)
 {
     static BlendMode curblendmode = BLEND_NONE;
     if (mode == curblendmode) return curblendmode;
+    FlushBatch();
     switch (mode)
     {
         case BLEND_NONE:     glDisable(GL_BLEND); break;
@@ -51,12 +52,14 @@ int SetBlendMode(BlendMode mode)
 
 void ClearFrameBuffer(const float3 &c)
 {
+    FlushBatch();
     glClearColor(c.x(), c.y(), c.z(), 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
 void Set2DMode(const int2 &screensize)
 {
+    FlushBatch();
     glDisable(GL_CULL_FACE);  
     glDisable(GL_DEPTH_TEST);
 
@@ -68,6 +71,7 @@ void Set2DMode(const int2 &screensize)
 
 void Set3DMode(float fovy, float ratio, float znear, float zfar)
 {
+    FlushBatch();
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);  
 
@@ -19,9 +19,27 @@
 
 #include "stb_image.h"
 
+// The context sdlsystem.cpp creates on OS X is a core profile, which doesn't have the GL_ALPHA, GL_LUMINANCE and
+// GL_LUMINANCE_ALPHA formats, so there textures with fewer than 4 bytes per pixel are expanded to rgba instead.
+#if defined(__APPLE__) && !defined(PLATFORM_MOBILE)
+    #define PLATFORM_GLCORE
+#endif
 
-uint CreateTexture(uchar *buf, int x, int y, bool clamp, bool mipmap)
+#ifdef PLATFORM_GLCORE
+// what an alphaonly texture samples as elsewhere: the rgb as 0, buf in the alpha
+static vector<uchar> AlphaToRGBA(const uchar *buf, int pixels)
 {
+    vector<uchar> rgba(pixels * 4, 0);
+    for (int i = 0; i < pixels; i++) rgba[i * 4 + 3] = buf[i];
+    return rgba;
+}
+#endif
+
+// A new texture, bound to unit 0.
+static uint GenTexture(bool clamp, bool mipmap)
+{
+    FlushBatch();  // we're about to change what unit 0 has bound
+
     uint id;
     glGenTextures(1, &id);
     assert(id);
@@ -34,9 +52,29 @@ uint CreateTexture(uchar *buf, int x, int y, bool clamp, bool mipmap)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 
+    return id;
+}
+
+uint CreateTexture(uchar *buf, int x, int y, bool clamp, bool mipmap, bool alphaonly)
+{
+    uint id = GenTexture(clamp, mipmap);
+
     //if (mipmap) glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, x, y, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+    #ifdef PLATFORM_GLCORE
+        vector<uchar> rgba;
+        if (alphaonly && buf)
+        {
+            rgba = AlphaToRGBA(buf, x * y);
+            buf = rgba.data();
+        }
+        alphaonly = false;
+    #endif
+
+    auto format = alphaonly ? GL_ALPHA : GL_RGBA;
+    if (alphaonly) glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows aren't necessarily a multiple of 4 bytes
+    glTexImage2D(GL_TEXTURE_2D, 0, format, x, y, 0, format, GL_UNSIGNED_BYTE, buf);
+    if (alphaonly) glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
     if (mipmap)
     {
@@ -47,31 +85,240 @@ uint CreateTexture(uchar *buf, int x, int y, bool clamp, bool mipmap)
     return id;
 }
 
-uint CreateTextureFromFile(const char *name)
+// What DecodeTexture() produces: this header, followed by the pixels of every mip level, largest first.
+struct DecodedTexture
 {
-    size_t len = 0;
-    auto fbuf = LoadFile(name, &len);
-    if (!fbuf)
-        return 0;
+    int x, y;
+    int comp;   // bytes per pixel: 1 (grey), 2 (grey + alpha) or 4 (rgba). always 4 with PLATFORM_GLCORE
+    int levels;
+};
+
+static int NextMipSize(int s) { return max(1, s / 2); }
+
+// 2x2 box filter. Of odd sizes the last row / column is dropped, except when it is all there is.
+static void Downsample(const uchar *src, int sx, int sy, uchar *dst, int comp)
+{
+    int dx = NextMipSize(sx), dy = NextMipSize(sy);
+    for (int y = 0; y < dy; y++)
+    {
+        auto row0 = src + min(y * 2,     sy - 1) * sx * comp;
+        auto row1 = src + min(y * 2 + 1, sy - 1) * sx * comp;
+        for (int x = 0; x < dx; x++)
+        {
+            int x0 = min(x * 2, sx - 1) * comp, x1 = min(x * 2 + 1, sx - 1) * comp;
+            for (int c = 0; c < comp; c++)
+                *dst++ = (uchar)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+        }
+    }
+}
 
+// Decodes a texture file and builds its mip chain, so all that's left for the GL thread is the upload.
+// Doesn't touch GL, so it can run on the async workers. Grey and grey + alpha images keep their 1 or 2 bytes per
+// pixel where the context can upload those, only rgb is always expanded to rgba. Returns a malloc-ed
+// DecodedTexture, or nullptr.
+static uchar *DecodeTexture(const uchar *fbuf, size_t flen, size_t &len)
+{
     int x, y, comp;
-    auto buf = stbi_load_from_memory(fbuf, len, &x, &y, &comp, 4);
+    auto img = stbi_load_from_memory(fbuf, (int)flen, &x, &y, &comp, 0);
+    if (!img)
+        return nullptr;
 
-    free(fbuf);
+    #ifdef PLATFORM_GLCORE
+        DecodedTexture hdr = { x, y, 4, 0 };
+    #else
+        DecodedTexture hdr = { x, y, comp == 3 ? 4 : comp, 0 };
+    #endif
+    size_t pixelbytes = 0;
+    for (int w = x, h = y;; w = NextMipSize(w), h = NextMipSize(h))
+    {
+        pixelbytes += w * h * hdr.comp;
+        hdr.levels++;
+        if (w == 1 && h == 1) break;
+    }
+
+    len = sizeof(DecodedTexture) + pixelbytes;
+    auto r = (uchar *)malloc(len);
+    if (r)
+    {
+        memcpy(r, &hdr, sizeof(DecodedTexture));
+        auto p = r + sizeof(DecodedTexture);
+        if (comp != hdr.comp)
+        {
+            // to rgba, as stb_image would: grey is copied to all of rgb, alpha is 0xFF if there is none
+            for (int i = 0; i < x * y; i++)
+            {
+                auto src = img + i * comp;
+                p[i * 4 + 0] = src[0];
+                p[i * 4 + 1] = src[comp >= 3 ? 1 : 0];
+                p[i * 4 + 2] = src[comp >= 3 ? 2 : 0];
+                p[i * 4 + 3] = comp == 2 ? src[1] : 0xFF;
+            }
+        }
+        else
+        {
+            memcpy(p, img, x * y * comp);
+        }
+        for (int l = 1, w = x, h = y; l < hdr.levels; l++, w = NextMipSize(w), h = NextMipSize(h))
+        {
+            auto next = p + w * h * hdr.comp;
+            Downsample(p, w, h, next, hdr.comp);
+            p = next;
+        }
+    }
+
+    stbi_image_free(img);
+    return r;
+}
+
+static uint UploadTexture(const uchar *decoded)
+{
+    DecodedTexture hdr;
+    memcpy(&hdr, decoded, sizeof(DecodedTexture));
+    #ifdef PLATFORM_GLCORE
+        assert(hdr.comp == 4);
+        GLenum format = GL_RGBA;
+    #else
+        // these sample as the rgba stb_image would have expanded them to
+        GLenum format = hdr.comp == 1 ? GL_LUMINANCE : (hdr.comp == 2 ? GL_LUMINANCE_ALPHA : GL_RGBA);
+    #endif
+
+    uint id = GenTexture(false, true);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    auto p = decoded + sizeof(DecodedTexture);
+    for (int l = 0, w = hdr.x, h = hdr.y; l < hdr.levels; l++, w = NextMipSize(w), h = NextMipSize(h))
+    {
+        glTexImage2D(GL_TEXTURE_2D, l, format, w, h, 0, format, GL_UNSIGNED_BYTE, p);
+        p += w * h * hdr.comp;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    return id;
+}
+
+// the key the decoded texture is stored under by LoadTextureAsync(), as opposed to the raw file
+static string TextureAsyncKey(const char *name) { return "texture:" + SanitizePath(name); }
+
+// Textures loaded by name, so loading the same file again shares it. Refcounted, so a ReleaseTexture() by one user
+// doesn't pull it out from under the others.
+struct CachedTexture
+{
+    uint id;
+    int refs;
+};
 
-    if (!buf)
+static map<string, CachedTexture> texturecache;
+static map<uint, string> texturenames;
+
+void LoadTextureAsync(const char *name)
+{
+    if (texturecache.find(SanitizePath(name)) != texturecache.end()) return;
+
+    string fn = name;
+    StartAsync(TextureAsyncKey(name), [fn](size_t &len) -> uchar *
+    {
+        size_t flen = 0;
+        auto fbuf = LoadFileDirect(fn.c_str(), &flen);
+        if (!fbuf) return nullptr;
+        auto r = DecodeTexture(fbuf, flen, len);
+        free(fbuf);
+        return r;
+    });
+}
+
+bool TextureLoadedAsync(const char *name) { return AsyncDone(TextureAsyncKey(name)); }
+
+uint CreateTextureFromFile(const char *name)
+{
+    uchar *decoded;
+    size_t dlen;
+    if (!TakeAsync(TextureAsyncKey(name), decoded, dlen))
+    {
+        size_t len = 0;
+        auto fbuf = LoadFile(name, &len);
+        if (!fbuf)
+            return 0;
+
+        decoded = DecodeTexture(fbuf, len, dlen);
+
+        free(fbuf);
+    }
+
+    if (!decoded)
         return 0;
 
-    uint id = CreateTexture(buf, x, y);
+    uint id = UploadTexture(decoded);
+
+    free(decoded);
+    return id;
+}
+
+uint LoadTexture(const char *name)
+{
+    auto key = SanitizePath(name);
+    auto it = texturecache.find(key);
+    if (it != texturecache.end())
+    {
+        it->second.refs++;
+        return it->second.id;
+    }
 
-    stbi_image_free(buf);
+    uint id = CreateTextureFromFile(name);
+    if (id)
+    {
+        CachedTexture ct = { id, 1 };
+        texturecache[key] = ct;
+        texturenames[id] = key;
+    }
     return id;
 }
 
-void DeleteTexture(uint id) { glDeleteTextures(1, &id); }
+void ReleaseTexture(uint id)
+{
+    auto it = texturenames.find(id);
+    if (it != texturenames.end())
+    {
+        if (--texturecache[it->second].refs) return;
+        texturecache.erase(it->second);
+        texturenames.erase(it);
+    }
+    DeleteTexture(id);
+}
+
+void TextureCacheClear()
+{
+    texturecache.clear();
+    texturenames.clear();
+}
+
+void UpdateTexture(uint id, int x, int y, int w, int h, uchar *buf, bool alphaonly)
+{
+    FlushBatch();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, id);
+    #ifdef PLATFORM_GLCORE
+        vector<uchar> rgba;
+        if (alphaonly)
+        {
+            rgba = AlphaToRGBA(buf, w * h);
+            buf = rgba.data();
+            alphaonly = false;
+        }
+    #endif
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, alphaonly ? GL_ALPHA : GL_RGBA, GL_UNSIGNED_BYTE, buf);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void DeleteTexture(uint id)
+{
+    FlushBatch();
+    glDeleteTextures(1, &id);
+}
 
 void SetTexture(uint textureunit, uint id)
 {
+    FlushBatch();
     glActiveTexture(GL_TEXTURE0 + textureunit);
     glBindTexture(GL_TEXTURE_2D, id);
 }
@@ -18,6 +18,7 @@
 #include "natreg.h"
 
 #include "glinterface.h"
+#include "glbatch.h"
 #include "sdlinterface.h"
 
 using namespace lobster;
@@ -28,8 +29,6 @@ Primitive polymode = PRIM_FAN;
 
 IntResourceManagerCompact<Mesh> *meshes = NULL;
 
-map<string, uint> texturecache;
-
 float4 curcolor = float4_0;
 
 Shader *currentshader = NULL;
@@ -38,10 +37,14 @@ Shader *colorshader = NULL;
 float3 lasthitsize = float3_0;
 float3 lastframehitsize = float3_0;
 
+BatchStats lastbatchstats = { 0, 0, 0 };
+
 bool graphics_initialized = false;
 
 void GraphicsShutDown()  // should be safe to call even if it wasn't initialized partially or at all
 {
+    FlushBatch();  // nothing to draw if never initialized, and must happen before the shaders go
+
     extern void CleanPhysics(); CleanPhysics();
     extern void MeshGenClear(); MeshGenClear();
     extern void FontCleanup(); FontCleanup();
@@ -52,7 +55,7 @@ void GraphicsShutDown()  // should be safe to call even if it wasn't initialized
         meshes = NULL;
     }
 
-    texturecache.clear();
+    TextureCacheClear();
 
     ShaderShutDown();
     currentshader = NULL;
@@ -131,6 +134,12 @@ int GetSampler(Value &i)
 
 void AddGraphics()
 {
+    #ifdef _DEBUG
+        // doesn't need a window, so can be checked on every start of a debug build
+        auto batcherr = BatchSelfTest();
+        if (!batcherr.empty()) throw string("batcher self test failed: ") + batcherr;
+    #endif
+
     STARTDECL(gl_window) (Value &title, Value &xs, Value &ys, Value &fullscreen)
     {
         if (graphics_initialized)
@@ -181,6 +190,8 @@ void AddGraphics()
     {
         TestGL();
 
+        lastbatchstats = EndBatchFrame();
+
         extern void CullFonts(); CullFonts();
 
         bool cb = SDLFrame(screensize);
@@ -411,8 +422,7 @@ void AddGraphics()
             vbuf[i].col = byte4_255;
         }
 
-        currentshader->Set();
-        RenderArray(polymode, vl.vval->len, "PNTC", sizeof(BasicVert), vbuf);
+        RenderBatched(currentshader, polymode, vbuf, vl.vval->len);
 
         delete[] vbuf;
 
@@ -425,18 +435,18 @@ void AddGraphics()
     {
         TestGL();
 
-        auto vbuf = new float3[segments.ival];
+        auto vbuf = new BasicVert[segments.ival];
 
         float step = PI * 2 / segments.ival;
         for (int i = 0; i < segments.ival; i++)
         {
             // + 1 to reduce "aliasing" from exact 0 / 90 degrees points
-            vbuf[i] = float3(sinf(i * step + 1) * radius.fval,
-                             cosf(i * step + 1) * radius.fval, 0);
+            BasicVert v = { float3(sinf(i * step + 1) * radius.fval,
+                                   cosf(i * step + 1) * radius.fval, 0), float3_0, float2_0, byte4_255 };
+            vbuf[i] = v;
         }
 
-        currentshader->Set();
-        RenderArray(polymode, segments.ival, "P", sizeof(float3), vbuf);
+        RenderBatched(currentshader, polymode, vbuf, segments.ival);
 
         delete[] vbuf;
 
@@ -578,18 +588,15 @@ void AddGraphics()
 
         auto v = ValueTo<float3>(vec);
 
-        static float tempquad_rect[20] =
+        BasicVert quad[4] =
         {
-            0, 0, 0, 0, 0,
-            0, 0, 0, 0, 1,
-            0, 0, 0, 1, 1,
-            0, 0, 0, 1, 0,
+            { float3(0,     0,     0), float3_0, float2(0, 0), byte4_255 },
+            { float3(0,     v.y(), 0), float3_0, float2(0, 1), byte4_255 },
+            { float3(v.x(), v.y(), 0), float3_0, float2(1, 1), byte4_255 },
+            { float3(v.x(), 0,     0), float3_0, float2(1, 0), byte4_255 },
         };
-        tempquad_rect[ 6] = tempquad_rect[11] = v.y();
-        tempquad_rect[10] = tempquad_rect[15] = v.x();
 
-        currentshader->Set();
-        RenderArray(polymode, 4, "PT", sizeof(float) * 5, tempquad_rect);
+        RenderBatched(currentshader, polymode, quad, 4);
 
         return vec;
     }
@@ -606,14 +613,32 @@ void AddGraphics()
         float angle = atan2f(v2.y() - v1.y(), v2.x() - v1.x());
         float3 v = float3(sinf(angle), -cosf(angle), 0) * thickness.fval / 2;
 
-        currentshader->Set();
-        RenderLine(polymode, v1, v2, v);
+        BasicVert quad[4] =
+        {
+            { v1 + v, float3_0, float2_0, byte4_255 },
+            { v1 - v, float3_0, float2_0, byte4_255 },
+            { v2 - v, float3_0, float2_0, byte4_255 },
+            { v2 + v, float3_0, float2_0, byte4_255 },
+        };
+
+        RenderBatched(currentshader, polymode, quad, 4);
 
         return Value();
     }
     ENDDECL3(gl_line, "start,end,thickness", "VVF", "",
         "renders a line with the given thickness");
 
+    STARTDECL(gl_batchstats) ()
+    {
+        g_vm->Push(Value(lastbatchstats.drawcalls));
+        return Value(lastbatchstats.primitives);
+    }
+    ENDDECL0(gl_batchstats, "", "", "II",
+        "returns how many draw calls the 2D primitives (gl_rect / gl_line / gl_circle / gl_polygon) took last frame,"
+        " and how many primitives that was. consecutive primitives are drawn together as long as nothing but the"
+        " transform changes in between, so changing the color, shader, blend mode or texture, or rendering"
+        " anything else, starts a new draw call.");
+
     STARTDECL(gl_perspective) (Value &fovy, Value &znear, Value &zfar)
     {
         Set3DMode(fovy.fval*RAD, screensize.x() / (float)screensize.y(), znear.fval, zfar.fval);
@@ -781,22 +806,34 @@ void AddGraphics()
         TestGL();
 
         ValueRef nameref(name);
-        auto it = texturecache.find(name.sval->str());
-        if (it != texturecache.end())
-        {
-            return Value((int)it->second);
-        }
-
-        uint id = CreateTextureFromFile(name.sval->str());
-
-        if (id) texturecache[name.sval->str()] = id;
-
-        return Value((int)id);
+        return Value((int)LoadTexture(name.sval->str()));
     }
     ENDDECL1(gl_loadtexture, "name", "S", "I",
         "returns texture id if succesfully loaded from file name, otherwise 0."
-        " Only loads from disk once if called again with the same name. Uses stb_image internally"
-        " (see http://nothings.org/), loads JPEG Baseline, subsets of PNG, TGA, BMP, PSD, GIF, HDR, PIC.");
+        " Only loads from disk once if called again with the same name (each call is then a reference that"
+        " gl_deletetexture releases). Uses stb_image internally"
+        " (see http://nothings.org/), loads JPEG Baseline, subsets of PNG, TGA, BMP, PSD, GIF, HDR, PIC."
+        " Greyscale images (with or without alpha) are kept at 1 or 2 bytes per pixel.");
+
+    STARTDECL(gl_loadtexture_async) (Value &name)
+    {
+        ValueRef nameref(name);
+        LoadTextureAsync(name.sval->str());
+        return Value();
+    }
+    ENDDECL1(gl_loadtexture_async, "name", "S", "",
+        "starts loading and decoding a texture (and making its mipmaps) on a background thread. once"
+        " gl_texture_loaded_async() says it is done, gl_loadtexture() of the same name only needs to upload it,"
+        " which avoids most of the stall.");
+
+    STARTDECL(gl_texture_loaded_async) (Value &name)
+    {
+        ValueRef nameref(name);
+        return Value(TextureLoadedAsync(name.sval->str()));
+    }
+    ENDDECL1(gl_texture_loaded_async, "name", "S", "I",
+        "returns whether a texture started with gl_loadtexture_async() is ready for gl_loadtexture(),"
+        " or was never started.");
 
     STARTDECL(gl_setprimitivetexture) (Value &i, Value &id)
     {
@@ -859,22 +896,15 @@ void AddGraphics()
 
     STARTDECL(gl_deletetexture) (Value &i)
     {
-        auto it = texturecache.begin();
-        // this is potentially expensive, we're counting on gl_deletetexture not being needed often
-        while (it != texturecache.end())
-        {
-            if (it->second == uint(i.ival)) texturecache.erase(it++);
-            else ++it;
-        }
-
         // the surfaces in meshes are still potentially referring to this texture,
         // but OpenGL doesn't care about illegal texture ids, so neither do we
-        DeleteTexture(i.ival);
+        ReleaseTexture(i.ival);
 
         return Value();
     }
     ENDDECL1(gl_deletetexture, "i", "I", "",
-        "free up memory for the given texture id");
+        "free up memory for the given texture id. one from gl_loadtexture is only freed once every load of it"
+        " has been deleted.");
 
     STARTDECL(gl_light) (Value &pos)
     {
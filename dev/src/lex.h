@@ -15,6 +15,27 @@
 namespace lobster
 {
 
+// A token's text, without owning it: points either into the source buffer, or into storage owned by the
+// lexer (decoded string literals, interned pushback tokens). Lexing a token thus never allocates.
+struct TokView
+{
+    const char *s;
+    size_t len;
+
+    TokView() : s(""), len(0) {}
+    TokView(const char *_s, size_t _len) : s(_s), len(_len) {}
+
+    string str() const { return string(s, len); }
+    operator string() const { return str(); }
+
+    bool operator==(const string &o) const { return len == o.size() && !memcmp(s, o.data(), len); }
+    bool operator!=(const string &o) const { return !(*this == o); }
+    bool operator==(const char *o) const { return !strncmp(s, o, len) && !o[len]; }
+};
+
+inline bool operator==(const string &a, const TokView &b) { return b == a; }
+inline bool operator!=(const string &a, const TokView &b) { return b != a; }
+
 struct LoadedFile
 {
     char *p, *linestart, *tokenstart, *source, *stringsource;
@@ -24,19 +45,26 @@ struct LoadedFile
     int errorline;  // line before, if current token crossed a line
     bool islf;
     bool cont;
-    string sattr;
+    TokView sattr;
+    int ival;       // pre-parsed value of T_INT tokens
+    double fval;    // pre-parsed value of T_FLOAT tokens
 
     vector<pair<int, bool>> indentstack;
     //char prevlineindenttype;
     const char *prevline, *prevlinetok;
 
-    struct Tok { TType t; string a; };
+    struct Tok { TType t; TokView a; int ival; double fval; };
 
-    vector<Tok> gentokens;
+    // Lookahead / pushback tokens, used as a stack. Fixed size so the common path never allocates: the deepest
+    // use is a dedent of many levels at once, which takes 2 slots per level.
+    enum { MAX_GENTOKENS = 128 };
+    Tok gentokens[MAX_GENTOKENS];
+    int numgentokens;
 
     LoadedFile(const char *fn, vector<string> &fns, char *_ss)
         : tokenstart(nullptr), stringsource(_ss), fileidx(fns.size()), token(T_NONE), line(1), errorline(1),
-          islf(false), cont(false), prevline(nullptr), prevlinetok(nullptr) /* prevlineindenttype(0) */
+          islf(false), cont(false), ival(0), fval(0), prevline(nullptr), prevlinetok(nullptr), numgentokens(0)
+          /* prevlineindenttype(0) */
     {
         source = stringsource;
         if (!source) source = (char *)LoadFile((string("include/") + fn).c_str());
@@ -63,6 +91,9 @@ struct Lex : LoadedFile
 
     vector<string> &filenames;
 
+    string strbuf;          // decoded string literals that contained escape codes
+    set<string> interned;   // text of tokens pushed back by the parser, stable for the lifetime of the lexer
+
     Lex(const char *fn, vector<string> &fns, char *_ss = nullptr) : LoadedFile(fn, fns, _ss), filenames(fns)
     {
         FirstToken();
@@ -88,6 +119,9 @@ struct Lex : LoadedFile
         }
 
         allfiles.insert(_fn);
+        // the included file will overwrite strbuf, so any pending token that refers to it needs its own copy
+        if (InStrBuf(sattr)) sattr = Intern(sattr);
+        for (int i = 0; i < numgentokens; i++) if (InStrBuf(gentokens[i].a)) gentokens[i].a = Intern(gentokens[i].a);
         parentfiles.push_back(*this);
 
         *((LoadedFile *)this) = LoadedFile(_fn, filenames, nullptr);
@@ -105,30 +139,46 @@ struct Lex : LoadedFile
         Next();
     }
     
-    void Push(TType t, const string &a = string())
+    bool InStrBuf(const TokView &v)
+    {
+        return v.s >= strbuf.data() && v.s < strbuf.data() + strbuf.size();
+    }
+
+    TokView Intern(const TokView &v)
     {
-        Tok tok;
+        auto &s = *interned.insert(v.str()).first;
+        return TokView(s.data(), s.size());
+    }
+
+    void Push(TType t, const TokView &a = TokView(), int iv = 0, double fv = 0)
+    {
+        if (numgentokens == MAX_GENTOKENS) Error("too many nested indentation levels");
+        auto &tok = gentokens[numgentokens++];
         tok.t = t;
         tok.a = a;
-        gentokens.push_back(tok);
+        tok.ival = iv;
+        tok.fval = fv;
     }
 
-    void PushCur() { Push(token, sattr); }
+    void PushCur() { Push(token, sattr, ival, fval); }
     
     void Undo(TType t, const string &a = string())
     {
         PushCur();
-        Push(t, a);
+        // a is typically a copy owned by the parser, so the lexer keeps its own
+        Push(t, a.empty() ? TokView() : Intern(TokView(a.data(), a.size())));
         Next();
     }
 
     void Next()
     {
-        if (gentokens.size())
+        if (numgentokens)
         {
-            token = gentokens.back().t;
-            sattr = gentokens.back().a;
-            gentokens.pop_back();
+            auto &tok = gentokens[--numgentokens];
+            token = tok.t;
+            sattr = tok.a;
+            ival = tok.ival;
+            fval = tok.fval;
             return;
         }
 
@@ -302,28 +352,8 @@ struct Lex : LoadedFile
                 if (isalpha(c) || c == '_' || c < 0)
                 {
                     while (isalnum(*p) || *p == '_' || *p < 0) p++;
-                    sattr = string(tokenstart, p);
-                    // add any new keywords also to TokStr below
-                    if      (sattr == "nil")       return T_NIL;
-                    else if (sattr == "true")    { sattr = "1"; return T_INT; }
-                    else if (sattr == "false")   { sattr = "0"; return T_INT; }
-                    else if (sattr == "return")    return T_RETURN; 
-                    else if (sattr == "struct")    return T_STRUCT; 
-                    else if (sattr == "value")     return T_VALUE;
-                    else if (sattr == "include")   return T_INCLUDE;
-                    else if (sattr == "int")       return T_INTTYPE;
-                    else if (sattr == "float")     return T_FLOATTYPE;
-                    else if (sattr == "string")    return T_STRTYPE;
-                    else if (sattr == "vector")    return T_VECTTYPE;
-                    else if (sattr == "function")  return T_FUN;
-                    else if (sattr == "super")     return T_SUPER;
-                    else if (sattr == "is")        return T_IS;
-                    else if (sattr == "from")      return T_FROM;
-                    else if (sattr == "program")   return T_PROGRAM;
-                    else if (sattr == "private")   return T_PRIVATE;
-                    else if (sattr == "coroutine") return T_COROUTINE;
-                    else if (sattr == "enum")      return T_ENUM;
-                    else return T_IDENT;
+                    sattr = TokView(tokenstart, p - tokenstart);
+                    return Keyword();
                 }
 
                 if (isdigit(c) || (c == '.' && isdigit(*p)))
@@ -333,12 +363,27 @@ struct Lex : LoadedFile
                         p++;
                         int val = 0;
                         while (isxdigit(*p)) val = (val << 4) | HexDigit(*p++);
-                        sattr = inttoa(val);
+                        sattr = TokView(tokenstart, p - tokenstart);
+                        ival = val;
                         return T_INT;
                     }
-                    while (isdigit(*p) || (*p=='.' && !isalpha(*(p + 1)))) p++;
-                    sattr = string(tokenstart, p);
-                    return strchr(sattr.c_str(), '.') ? T_FLOAT : T_INT;
+                    bool isfloat = false;
+                    while (isdigit(*p) || (*p=='.' && !isalpha(*(p + 1)))) isfloat |= *p++ == '.';
+                    sattr = TokView(tokenstart, p - tokenstart);
+                    if (isfloat)
+                    {
+                        // copy, since strtod would happily read past the end of the token (e.g. "1e5")
+                        char buf[64];
+                        if (sattr.len >= sizeof(buf)) Error("floating point literal too long");
+                        memcpy(buf, sattr.s, sattr.len);
+                        buf[sattr.len] = 0;
+                        fval = strtod(buf, nullptr);
+                        return T_FLOAT;
+                    }
+                    uint val = 0;
+                    for (auto d = tokenstart; d < p; d++) val = val * 10 + (*d - '0');
+                    ival = (int)val;
+                    return T_INT;
                 }
 
                 if (c == '.') return T_DOT;
@@ -350,6 +395,38 @@ struct Lex : LoadedFile
         }
     }
 
+    TType Keyword()
+    {
+        // add any new keywords also to TokStr below
+        static const struct { const char *kw; TType t; } keywords[] =
+        {
+            { "nil",       T_NIL },
+            { "return",    T_RETURN },
+            { "struct",    T_STRUCT },
+            { "value",     T_VALUE },
+            { "include",   T_INCLUDE },
+            { "int",       T_INTTYPE },
+            { "float",     T_FLOATTYPE },
+            { "string",    T_STRTYPE },
+            { "vector",    T_VECTTYPE },
+            { "hashmap",   T_HASHMAPTYPE },
+            { "function",  T_FUN },
+            { "super",     T_SUPER },
+            { "is",        T_IS },
+            { "from",      T_FROM },
+            { "program",   T_PROGRAM },
+            { "private",   T_PRIVATE },
+            { "coroutine", T_COROUTINE },
+            { "enum",      T_ENUM },
+        };
+
+        if (sattr.len < 2 || sattr.len > 9) return T_IDENT;  // lengths of the shortest / longest keywords
+        if (sattr == "true")  { ival = 1; return T_INT; }
+        if (sattr == "false") { ival = 0; return T_INT; }
+        for (auto &k : keywords) if (*k.kw == *sattr.s && sattr == k.kw) return k.t;
+        return T_IDENT;
+    }
+
     char HexDigit(char c)
     {
         if (isdigit(c)) return c - '0';
@@ -359,8 +436,10 @@ struct Lex : LoadedFile
 
     TType LexString(int initial)
     {
+        // strings without escape codes are returned as a view into the source, others are decoded into strbuf
         char c = 0;
-        sattr = "";
+        auto start = p;
+        bool escaped = false;
 
         while ((c = *p++) != initial) switch (c)
         {
@@ -374,6 +453,11 @@ struct Lex : LoadedFile
                 Error("\' and \" should be prefixed with a \\ in a string constant");
 
             case '\\':
+                if (!escaped)
+                {
+                    strbuf.assign(start, p - 1);
+                    escaped = true;
+                }
                 switch(c = *p++)
                 {
                     case 'n': c = '\n'; break;
@@ -392,24 +476,26 @@ struct Lex : LoadedFile
                         p--;
                         Error("unknown control code in string constant");
                 };
-                sattr += c;
+                strbuf += c;
                 break;
 
             default:
                 if (c<' ') Error("unprintable character in string constant");
-                sattr += c;
+                if (escaped) strbuf += c;
         };
 
+        sattr = escaped ? TokView(strbuf.data(), strbuf.size()) : TokView(start, p - 1 - start);
+
         if (initial == '\"')
         {
             return T_STR;
         }
         else
         {
-            if (sattr.size() > 4) Error("character constant too long");
-            int ival = 0;
-            for (auto c : sattr) ival = (ival << 8) + c;
-            sattr = inttoa(ival);
+            if (sattr.len > 4) Error("character constant too long");
+            ival = 0;
+            for (size_t i = 0; i < sattr.len; i++) ival = (ival << 8) + sattr.s[i];
+            sattr = TokView(tokenstart, p - tokenstart);
             return T_INT;
         };
     };
@@ -423,9 +509,9 @@ struct Lex : LoadedFile
             {
                 case T_IDENT:
                 case T_FLOAT:
-                case T_INT: return sattr;
+                case T_INT: return sattr.str();
                 case T_STR:  // FIXME: will not deal with other escape codes, use ToString code
-                             return "\"" + sattr + "\"";
+                             return "\"" + sattr.str() + "\"";
             }
         }
         return TName(t);
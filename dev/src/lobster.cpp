@@ -23,7 +23,7 @@
 namespace lobster
 {
     SlabAlloc *vmpool = nullptr;               // set during the lifetime of a VM object
-    static SlabAlloc *parserpool = nullptr;    // set during the lifetime of a Parser object
+    static Arena *parserpool = nullptr;        // set during the lifetime of a Parser object
 }
 
 #include "vmdata.h"
@@ -43,6 +43,9 @@ namespace lobster
     const Type g_type_vector_float (V_VECTOR, &*type_float); TypeRef type_vector_float = &g_type_vector_float;
     const Type g_type_function_null(V_FUNCTION);             TypeRef type_function_null = &g_type_function_null;
     const Type g_type_coroutine    (V_COROUTINE);            TypeRef type_coroutine = &g_type_coroutine;
+    const Type g_type_hashmap      (V_HASHMAP);              TypeRef type_hashmap = &g_type_hashmap;
+    const Type g_type_prioqueue    (V_PRIOQUEUE);            TypeRef type_prioqueue = &g_type_prioqueue;
+    const Type g_type_strbuilder   (V_STRBUILDER);           TypeRef type_strbuilder = &g_type_strbuilder;
 }
 
 #include "ttypes.h"
@@ -50,12 +50,17 @@ struct ValueParser
     {
         switch (lex.token)
         {
-            case T_INT:   { int i    = atoi(lex.sattr.c_str()); lex.Next(); return Value(i); }
-            case T_FLOAT: { double f = atof(lex.sattr.c_str()); lex.Next(); return Value((float)f); }
-            case T_STR:   { string s = lex.sattr;               lex.Next(); auto str = g_vm->NewString(s);
-                                                                            allocated.push_back(str);
-                                                                            return Value(str); }     
-            case T_NIL:   {                                     lex.Next(); return Value(0, V_NIL); }
+            case T_INT:   { int i    = lex.ival; lex.Next(); return Value(i); }
+            case T_FLOAT: { double f = lex.fval; lex.Next(); return Value((float)f); }
+            case T_NIL:   {                      lex.Next(); return Value(0, V_NIL); }
+
+            case T_STR:
+            {
+                auto str = g_vm->NewString(lex.sattr.s, (int)lex.sattr.len);
+                allocated.push_back(str);
+                lex.Next();
+                return Value(str);
+            }
 
             case T_MINUS:
             {
@@ -133,8 +138,202 @@ struct ValueParser
     }
 };
 
+// Parses the subset of the syntax that ToString() produces (which is what parse_data is used for almost always) in a
+// single pass over the text, allocating directly into VM objects. Anything it doesn't understand makes it give up,
+// after which ValueParser above takes over, which handles the full syntax and generates proper errors.
+struct FastValueParser
+{
+    const char *p;
+    vector<Value> elems;    // elements of all vectors under construction, shared between nesting levels
+    string sbuf;            // decoded strings
+
+    // last struct looked up, since data tends to contain long runs of the same type
+    string lastname;
+    int lastidx;
+    size_t lastreqargs;
+
+    FastValueParser(const char *_p) : p(_p), lastidx(-1), lastreqargs(0) {}
+
+    ~FastValueParser()
+    {
+        for (auto &e : elems) e.DEC();  // only if we gave up halfway
+    }
+
+    void Skip() { while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++; }
+
+    static bool IsIdChar(char c) { return isalnum(c) || c == '_' || c < 0; }
+
+    bool Parse(Value &v)
+    {
+        Skip();
+        if (!ParseFactor(v)) return false;
+        Skip();
+        if (*p) { v.DEC(); return false; }
+        return true;
+    }
+
+    bool ParseFactor(Value &v)
+    {
+        switch (*p)
+        {
+            case '-':
+                p++;
+                Skip();
+                if (!isdigit(*p) && *p != '.') return false;
+                if (!ParseNumber(v)) return false;
+                if (v.type == V_INT) v.ival *= -1; else v.fval *= -1;
+                return true;
+
+            case '\"': return ParseString(v);
+            case '[':  return ParseVector(v);
+
+            default:
+                if (isdigit(*p) || (*p == '.' && isdigit(p[1]))) return ParseNumber(v);
+                if (IsWord("nil"))   { v = Value(0, V_NIL); return true; }
+                if (IsWord("true"))  { v = Value(true);     return true; }
+                if (IsWord("false")) { v = Value(false);    return true; }
+                return false;
+        }
+    }
+
+    bool IsWord(const char *w)
+    {
+        auto len = strlen(w);
+        if (strncmp(p, w, len) || IsIdChar(p[len])) return false;
+        p += len;
+        return true;
+    }
+
+    bool ParseNumber(Value &v)
+    {
+        // same rules as the lexer, minus hex
+        auto start = p;
+        if (*p == '0' && p[1] == 'x') return false;
+        bool isfloat = false;
+        while (isdigit(*p) || (*p == '.' && !isalpha(p[1]))) isfloat |= *p++ == '.';
+        if (IsIdChar(*p)) return false;
+        if (isfloat)
+        {
+            char buf[64];
+            if (p - start >= (int)sizeof(buf)) return false;
+            memcpy(buf, start, p - start);
+            buf[p - start] = 0;
+            v = Value((float)strtod(buf, nullptr));
+        }
+        else
+        {
+            uint i = 0;
+            for (auto d = start; d < p; d++) i = i * 10 + (*d - '0');
+            v = Value((int)i);
+        }
+        return true;
+    }
+
+    bool ParseString(Value &v)
+    {
+        sbuf.clear();
+        for (p++;;)
+        {
+            char c = *p++;
+            switch (c)
+            {
+                case '\"':
+                    v = Value(g_vm->NewString(sbuf.data(), (int)sbuf.size()));
+                    return true;
+
+                case '\\':
+                    switch (c = *p++)
+                    {
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case 'r': c = '\r'; break;
+                        case '\\':
+                        case '\"':
+                        case '\'': break;
+                        case 'x':
+                            if (!isxdigit(*p) || !isxdigit(p[1])) return false;
+                            c = (char)((HexDigit(*p) << 4) | HexDigit(p[1]));
+                            p += 2;
+                            break;
+                        default:
+                            return false;
+                    }
+                    sbuf += c;
+                    break;
+
+                default:
+                    if (c < ' ' || c == '\'') return false;
+                    sbuf += c;
+            }
+        }
+    }
+
+    static int HexDigit(char c) { return isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10; }
+
+    bool ParseVector(Value &v)
+    {
+        p++;
+        Skip();
+        size_t base = elems.size();
+        if (*p == ']') p++;
+        else for (;;)
+        {
+            Value e;
+            if (!ParseFactor(e)) return false;
+            elems.push_back(e);
+            Skip();
+            if (*p == ']') { p++; break; }
+            if (*p != ',') return false;
+            p++;
+            Skip();
+        }
+
+        int type = V_VECTOR;
+        auto save = p;
+        Skip();
+        if (*p == ':')
+        {
+            p++;
+            Skip();
+            auto name = p;
+            if (!isalpha(*p) && *p != '_') return false;
+            while (IsIdChar(*p)) p++;
+            size_t len = p - name;
+            if (len != lastname.size() || strncmp(name, lastname.c_str(), len))
+            {
+                lastname.assign(name, len);
+                lastidx = g_vm->StructIdx(lastname, lastreqargs);
+            }
+            if (lastidx >= 0)   // if unknown type, becomes regular vector
+            {
+                // pad with NIL if current type has more fields, drop elements if it has less
+                while (elems.size() - base < lastreqargs) elems.push_back(Value(0, V_NIL));
+                while (elems.size() - base > lastreqargs) { elems.back().DEC(); elems.pop_back(); }
+                type = lastidx;
+            }
+        }
+        else
+        {
+            p = save;
+        }
+
+        auto vec = g_vm->NewVector((int)(elems.size() - base), type);
+        for (size_t i = base; i < elems.size(); i++) vec->push(elems[i]);
+        elems.resize(base);
+        v = Value(vec);
+        return true;
+    }
+};
+
 static Value ParseData(char *inp)
 {
+    Value v;
+    if (FastValueParser(inp).Parse(v))
+    {
+        g_vm->Push(v);
+        return Value(0, V_NIL);
+    }
+
     try
     {
         ValueParser parser(inp);
@@ -148,6 +347,255 @@ static Value ParseData(char *inp)
     }
 }
 
+// Binary encoding of the same values parse_data supports. Values are tagged, integers and lengths are varints, struct
+// types are stored by name (once, after that by index) so they can be matched up with the current definitions upon
+// loading, and any string or vector that occurs more than once in the graph is written once, with later occurrences
+// referring back to it, which preserves sharing and makes cycles work.
+
+static const char *binaryheader = "LBV1";
+
+enum { BIN_NIL, BIN_INT, BIN_FLOAT, BIN_STRING, BIN_VECTOR, BIN_STRUCT, BIN_REF };
+
+struct BinaryWriter
+{
+    string out;
+    map<RefObj *, int> objs;
+    map<int, int> structnames;  // struct idx -> name idx
+
+    BinaryWriter() { out.append(binaryheader, 4); }
+
+    void VarInt(uint x)
+    {
+        while (x >= 0x80) { out += (char)(x | 0x80); x >>= 7; }
+        out += (char)x;
+    }
+
+    void Write(const Value &v)
+    {
+        switch (v.type)
+        {
+            case V_NIL: out += (char)BIN_NIL; break;
+
+            case V_INT:
+                out += (char)BIN_INT;
+                VarInt(((uint)v.ival << 1) ^ (uint)(v.ival >> 31));  // zigzag, so small negative ints are small
+                break;
+
+            case V_FLOAT:
+            {
+                out += (char)BIN_FLOAT;
+                uint bits;
+                memcpy(&bits, &v.fval, sizeof(uint));
+                for (int i = 0; i < 4; i++) out += (char)(bits >> (i * 8));
+                break;
+            }
+
+            case V_STRING:
+            case V_VECTOR:
+            {
+                auto it = objs.find(v.ref);
+                if (it != objs.end())
+                {
+                    out += (char)BIN_REF;
+                    VarInt(it->second);
+                    break;
+                }
+                objs[v.ref] = (int)objs.size();
+
+                if (v.type == V_STRING)
+                {
+                    out += (char)BIN_STRING;
+                    VarInt(v.sval->len);
+                    out.append(v.sval->str(), v.sval->len);
+                    break;
+                }
+
+                auto vec = v.vval;
+                if (vec->type >= 0)
+                {
+                    out += (char)BIN_STRUCT;
+                    auto sit = structnames.find(vec->type);
+                    if (sit != structnames.end())
+                    {
+                        VarInt(sit->second);
+                    }
+                    else
+                    {
+                        auto idx = (int)structnames.size();
+                        structnames[vec->type] = idx;
+                        VarInt(idx);  // new name follows
+                        auto &name = g_vm->ReverseLookupType(vec->type);
+                        VarInt((uint)name.size());
+                        out += name;
+                    }
+                }
+                else
+                {
+                    out += (char)BIN_VECTOR;
+                }
+                VarInt(vec->len);
+                for (int i = 0; i < vec->len; i++) Write(vec->at(i));
+                break;
+            }
+
+            default:
+                g_vm->BuiltinError(string("serialize_binary: cannot serialize values of type ") +
+                                   BaseTypeName(v.type));
+        }
+    }
+};
+
+// Reading is done in two passes: the first only validates the structure of the data, such that the second, which
+// creates the VM objects, can't fail halfway through and leave us with partial (possibly cyclic) garbage.
+struct BinaryReader
+{
+    const uchar *start, *p, *end;
+
+    struct StructName { string name; int idx; size_t reqargs; };
+    vector<StructName> structnames;
+    size_t numnames;
+    vector<RefObj *> objs;
+    size_t numobjs;
+
+    BinaryReader(const uchar *_p, size_t len) : start(_p), p(_p), end(_p + len), numnames(0), numobjs(0) {}
+
+    ~BinaryReader()
+    {
+        for (auto o : objs) Value(o).DECRT();
+    }
+
+    void Error(const char *err) { throw string("deserialize_binary: ") + err; }
+
+    void Need(size_t n) { if ((size_t)(end - p) < n) Error("data truncated"); }
+
+    uint VarInt()
+    {
+        uint x = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            if (p == end || shift > 28) Error("data truncated or corrupt");
+            auto b = *p++;
+            x |= (uint)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return x;
+        }
+    }
+
+    // struct name references are either the index of a name seen before, or the next index followed by the name
+    StructName &StructRef(bool validate)
+    {
+        auto idx = VarInt();
+        if (idx < numnames) return structnames[idx];
+        if (idx > numnames) Error("unknown struct name");
+        auto len = VarInt();
+        if (validate)
+        {
+            Need(len);
+            StructName sn;
+            sn.name.assign((const char *)p, len);
+            sn.idx = g_vm->StructIdx(sn.name, sn.reqargs);
+            structnames.push_back(sn);
+        }
+        p += len;
+        return structnames[numnames++];
+    }
+
+    void Validate()
+    {
+        Need(1);
+        switch (*p++)
+        {
+            case BIN_NIL:    break;
+            case BIN_INT:    VarInt(); break;
+            case BIN_FLOAT:  Need(4); p += 4; break;
+            case BIN_STRING: { auto len = VarInt(); Need(len); p += len; numobjs++; break; }
+            case BIN_REF:    if (VarInt() >= numobjs) Error("reference to unknown object"); break;
+
+            case BIN_STRUCT:
+                StructRef(true);
+                // fall thru:
+            case BIN_VECTOR:
+            {
+                numobjs++;
+                auto len = VarInt();
+                Need(len);  // at least 1 byte per element
+                for (uint i = 0; i < len; i++) Validate();
+                break;
+            }
+
+            default:
+                Error("unknown value tag");
+        }
+    }
+
+    Value Read()
+    {
+        auto tag = *p++;
+        switch (tag)
+        {
+            case BIN_INT:
+            {
+                auto x = VarInt();
+                return Value((int)((x >> 1) ^ (0 - (x & 1))));
+            }
+
+            case BIN_FLOAT:
+            {
+                uint bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+                p += 4;
+                float f;
+                memcpy(&f, &bits, sizeof(float));
+                return Value(f);
+            }
+
+            case BIN_STRING:
+            {
+                int len = (int)VarInt();
+                auto s = g_vm->NewString((const char *)p, len);
+                p += len;
+                s->refc++;  // kept alive until we're done, since later references may refer to it
+                objs.push_back(s);
+                return Value(s);
+            }
+
+            case BIN_REF:
+                return Value(objs[VarInt()]).INC();
+
+            case BIN_STRUCT:
+            case BIN_VECTOR:
+            {
+                auto sn = tag == BIN_STRUCT ? &StructRef(false) : nullptr;
+                int len = (int)VarInt();
+                auto vec = g_vm->NewVector(len, V_VECTOR);
+                vec->refc++;
+                objs.push_back(vec);
+                for (int i = 0; i < len; i++) vec->push(Read());
+                if (sn && sn->idx >= 0)  // if unknown type, becomes regular vector
+                {
+                    // pad with NIL if current type has more fields, drop elements if it has less
+                    while (vec->len < (int)sn->reqargs) vec->push(Value(0, V_NIL));
+                    while (vec->len > (int)sn->reqargs) vec->pop().DEC();
+                    vec->type = sn->idx;
+                }
+                return Value(vec);
+            }
+
+            default:
+                return Value(0, V_NIL);
+        }
+    }
+
+    Value Parse()
+    {
+        if ((size_t)(end - p) < 4 || memcmp(p, binaryheader, 4)) Error("not binary lobster data");
+        p += 4;
+        Validate();
+        if (p != end) Error("trailing data");
+        p = start + 4;
+        numnames = 0;
+        return Read();
+    }
+};
+
 void AddReaderOps()
 {
     STARTDECL(parse_data) (Value &ins)
@@ -163,8 +611,38 @@ void AddReaderOps()
         " truncated, missing elements will be set to nil, and unknown type means downgrade to vector."
         " useful for simple file formats. returns the value and an error string as second return value"
         " (or nil if no error)");
-}
 
-AutoRegister __aro("parsedata", AddReaderOps);
+    STARTDECL(serialize_binary) (Value &v)
+    {
+        ValueRef vref(v);
+        BinaryWriter bw;
+        bw.Write(v);
+        return Value(g_vm->NewString(bw.out));
+    }
+    ENDDECL1(serialize_binary, "x", "A", "S",
+        "converts a data structure (int/float/string/vector/struct/nil, like parse_data()) to a compact binary"
+        " string, much faster to read back than text with deserialize_binary(). struct types are stored by name,"
+        " and strings/vectors referred to more than once (including cycles) are stored once.");
 
+    STARTDECL(deserialize_binary) (Value &ins)
+    {
+        ValueRef iref(ins);
+        try
+        {
+            BinaryReader br((uchar *)ins.sval->str(), ins.sval->len);
+            g_vm->Push(br.Parse());
+            return Value(0, V_NIL);
+        }
+        catch (string &s)
+        {
+            g_vm->Push(Value(0, V_NIL));
+            return Value(g_vm->NewString(s));
+        }
+    }
+    ENDDECL1(deserialize_binary, "bindata", "S", "As",
+        "converts a string created by serialize_binary() back into a data structure. like parse_data(), structs are"
+        " made compatible with their current definitions. returns the value and an error string as second return"
+        " value (or nil if no error)");
+}
 
+AutoRegister __aro("parsedata", AddReaderOps);
@@ -7,6 +7,9 @@
 
 #include "mctables.h"
 
+#include <thread>
+#include <queue>
+
 using namespace lobster;
 
 
@@ -58,14 +61,110 @@ class findex
 
     void setm(int m) { i = (i & ~MATMASK) | m; }
     void seti(int j) { i = (i & MATMASK) | (j << MATBITS); }
+
+    bool operator==(const findex &o) const { return i == o.i; }
+    bool operator!=(const findex &o) const { return i != o.i; }
 };
 
-inline int IndexGrid(const int3 &v, const int3 &gridsize)
+// Sparse grid of cells, in bricks of B^3 that are only allocated once their cells stop being all the same value.
+// Most of a high resolution grid is empty or solid, so memory grows with the surface area instead of the volume.
+// Different threads may write to different bricks at the same time.
+template<typename T> class BrickGrid
 {
-    return v.x() * gridsize.y() * gridsize.z() +
-           v.y() * gridsize.z() +
-           v.z();
-}
+    int3 bsize;
+    vector<T *> bricks;  // nullptr where all cells have the value in uniform
+    vector<T> uniform;
+
+    int BrickIndex(const int3 &b) const { return (b.x() * bsize.y() + b.y()) * bsize.z() + b.z(); }
+    int BrickOf(const int3 &v) const { return BrickIndex(int3(v.x() >> SHIFT, v.y() >> SHIFT, v.z() >> SHIFT)); }
+    static int CellIndex(const int3 &v) { return (((v.x() & (B - 1)) << SHIFT | (v.y() & (B - 1))) << SHIFT) | (v.z() & (B - 1)); }
+
+    public:
+
+    static const int SHIFT = 3, B = 1 << SHIFT;
+
+    BrickGrid(const int3 &size, T def) : bsize((size + (B - 1)) / B)
+    {
+        bricks.resize(bsize.x() * bsize.y() * bsize.z(), nullptr);
+        uniform.resize(bricks.size(), def);
+    }
+
+    ~BrickGrid() { for (auto b : bricks) delete[] b; }
+
+    T Get(const int3 &v) const
+    {
+        auto bi = BrickOf(v);
+        auto b = bricks[bi];
+        return b ? b[CellIndex(v)] : uniform[bi];
+    }
+
+    // copies the n cells from v onwards along z into dest, looking up each brick only once
+    void GetRow(const int3 &v, int n, T *dest) const
+    {
+        for (int z = v.z(), zend = v.z() + n; z < zend; )
+        {
+            int3 c(v.x(), v.y(), z);
+            auto bi = BrickOf(c);
+            auto b = bricks[bi];
+            auto run = min(B - (z & (B - 1)), zend - z);
+            if (b) for (int i = 0; i < run; i++) *dest++ = b[CellIndex(c) + i];
+            else   for (int i = 0; i < run; i++) *dest++ = uniform[bi];
+            z += run;
+        }
+    }
+
+    T &Ref(const int3 &v)
+    {
+        auto bi = BrickOf(v);
+        auto &b = bricks[bi];
+        if (!b)
+        {
+            b = new T[B * B * B];
+            for (int i = 0; i < B * B * B; i++) b[i] = uniform[bi];
+        }
+        return b[CellIndex(v)];
+    }
+
+    // true if all cells of brick b (in brick coordinates) are the same, which is then stored in val
+    bool Uniform(const int3 &b, T &val) const
+    {
+        auto bi = BrickIndex(b);
+        if (bricks[bi]) return false;
+        val = uniform[bi];
+        return true;
+    }
+
+    // frees the bricks touching cells lo .. hi (inclusive) where all cells have the same value
+    void Compact(const int3 &lo, const int3 &hi)
+    {
+        for (int x = lo.x() / B; x <= hi.x() / B; x++)
+            for (int y = lo.y() / B; y <= hi.y() / B; y++)
+                for (int z = lo.z() / B; z <= hi.z() / B; z++)
+        {
+            auto bi = BrickIndex(int3(x, y, z));
+            auto &b = bricks[bi];
+            if (!b) continue;
+            int i = 1;
+            while (i < B * B * B && b[i] == b[0]) i++;
+            if (i < B * B * B) continue;
+            uniform[bi] = b[0];
+            delete[] b;
+            b = nullptr;
+        }
+    }
+};
+
+// polygonize_mc splits the grid into slabs of x layers, which are filled and triangulated in parallel.
+// Each slab only ever writes to its own cells (and bricks), and the result is the same no matter how many slabs
+// there are.
+struct GridSlab
+{
+    int x0, x1;                         // the layers of cells this slab owns, x0 is a multiple of the brick size
+    vector<fcell> fcells;               // for the cells in this slab, index 0 means no per cell data
+    vector<findex> ghost;               // materials of layer x0 - 1 (owned by the previous slab), for edges along x
+    unordered_map<int, int> nextedges;  // like fcell::edgeidx, for edges owned by layer x1 (the next slab)
+    vector<int> edgeremap;              // from this slab's edges to the final list
+};
 
 float3 rotated_size(const float3x3 &rot, const float3 &size)
 {
@@ -73,6 +172,11 @@ float3 rotated_size(const float3x3 &rot, const float3 &size)
     return absm * size;
 }
 
+// Helpers for ImplicitFunction::Hash. Floats go in bit for bit, so -0 and 0 hash differently, which at worst costs
+// a cache miss.
+template<typename T> void HashValue(SHA256 &h, const T &v) { h.Update(&v, sizeof(T)); }
+inline void HashTag(SHA256 &h, const char *tag) { h.Update(tag, strlen(tag) + 1); }
+
 struct ImplicitFunction
 {
     float3 orig;
@@ -82,120 +186,448 @@ struct ImplicitFunction
 
     virtual ~ImplicitFunction() {}
 
+    // Feeds everything that determines this shape into h, for the mesh cache. Each shape adds a tag and its own
+    // parameters before calling this.
+    virtual void Hash(SHA256 &h)
+    {
+        HashValue(h, orig);
+        HashValue(h, size);
+        HashValue(h, rot);
+        HashValue(h, material);
+    }
+
     inline bool Eval(const float3 & /*pos*/) { return false; }
 
     virtual float3 ComputeSize() { return size; };
-    virtual void FillGrid(const int3 &start, const int3 &end, const int3 &gridsize, findex *fcellindices,
-                          vector<fcell> &fcells, const float3 &gridscale, const float3 &gridtrans,
+    virtual void FillGrid(const int3 &start, const int3 &end, const int3 &gridsize, BrickGrid<findex> &grid,
+                          GridSlab &slab, const float3 &gridscale, const float3 &gridtrans,
                           const float3x3 &gridrot) = 0;
 };
 
 static int3 axesi[] = { int3(1, 0, 0), int3(0, 1, 0), int3(0, 0, 1) };
 static float3 axesf[] = { float3(1, 0, 0), float3(0, 1, 0), float3(0, 0, 1) };
 
+// Polynomial approximations of log2(m) for m in [sqrt(0.5), sqrt(2)), from s = (m - 1) / (m + 1), and of 2^f for f in
+// [-0.5, 0.5). For floats, and for f4 below.
+template<typename F> inline F log2poly(const F &s)
+{
+    // 2 / ln(2) * atanh(s)
+    auto s2 = s * s;
+    return s * (2.88539008f + s2 * (0.961796694f + s2 * (0.577078016f + s2 * (0.412198583f + s2 * 0.320598898f))));
+}
+
+template<typename F> inline F exp2poly(const F &f)
+{
+    return 1.41421356f * (1.0f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f + f * (0.00961812911f +
+                                                         f * (0.00133335581f + f * 0.000154035304f))))));
+}
+
+// powf is by far the slowest part of sampling the super shapes, and has no SIMD version. This computes x^e for
+// x >= 0 as 2^(e * log2(x)) with polynomials instead, which the f4 version below does 4 at a time. Relative error is
+// below 1e-5, and around 1e-7 for results near 1, which is where the shapes compare against.
+inline float fastpow(float x, float e)
+{
+    int bits;
+    memcpy(&bits, &x, sizeof(float));
+    int ex = ((bits >> 23) & 0xFF) - 127;
+    int mbits = (bits & 0x7FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &mbits, sizeof(float));
+    int big = m > 1.41421356f;
+    m *= big ? 0.5f : 1.0f;
+    ex += big;
+    float y = max(-127.0f, min(127.0f, e * (ex + log2poly((m - 1) / (m + 1)))));
+    int n = (int)y;
+    n -= y < n;
+    int scalebits = (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &scalebits, sizeof(float));
+    return x > 0 && y > -126 ? exp2poly(y - n - 0.5f) * scale : 0.0f;
+}
+
+inline float3 fastpow(const float3 &a, const float3 &b)
+{
+    return float3(fastpow(a.x(), b.x()), fastpow(a.y(), b.y()), fastpow(a.z(), b.z()));
+}
+
+// 4 floats at once, for evaluating shapes in batches. Uses SSE2 where the compiler targets it, plain loops otherwise.
+// Comparisons give masks, which are only meant for &, select() and StoreMask().
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+struct f4
+{
+    __m128 v;
+
+    f4() {}
+    f4(__m128 _v) : v(_v) {}
+    f4(float f) : v(_mm_set1_ps(f)) {}
+
+    static f4 Load(const float *p) { return _mm_loadu_ps(p); }
+};
+
+inline f4 operator+(const f4 &a, const f4 &b) { return _mm_add_ps(a.v, b.v); }
+inline f4 operator-(const f4 &a, const f4 &b) { return _mm_sub_ps(a.v, b.v); }
+inline f4 operator*(const f4 &a, const f4 &b) { return _mm_mul_ps(a.v, b.v); }
+inline f4 operator/(const f4 &a, const f4 &b) { return _mm_div_ps(a.v, b.v); }
+inline f4 operator< (const f4 &a, const f4 &b) { return _mm_cmplt_ps(a.v, b.v); }
+inline f4 operator<=(const f4 &a, const f4 &b) { return _mm_cmple_ps(a.v, b.v); }
+inline f4 operator> (const f4 &a, const f4 &b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline f4 operator>=(const f4 &a, const f4 &b) { return _mm_cmpge_ps(a.v, b.v); }
+inline f4 operator&(const f4 &a, const f4 &b) { return _mm_and_ps(a.v, b.v); }
+
+inline f4 select(const f4 &mask, const f4 &a, const f4 &b)
+{
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+inline f4 abs(const f4 &a) { return _mm_and_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF))); }
+inline f4 sqrt(const f4 &a) { return _mm_sqrt_ps(a.v); }
+inline f4 min(const f4 &a, const f4 &b) { return _mm_min_ps(a.v, b.v); }
+inline f4 max(const f4 &a, const f4 &b) { return _mm_max_ps(a.v, b.v); }
+
+inline void StoreMask(uchar *dest, const f4 &mask)
+{
+    auto bits = _mm_movemask_ps(mask.v);
+    for (int i = 0; i < 4; i++) dest[i] = (bits >> i) & 1;
+}
+
+// same as fastpow(float, float) above, 4 at a time
+inline f4 fastpow(const f4 &x, const f4 &e)
+{
+    auto bits = _mm_castps_si128(x.v);
+    auto ex = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xFF)), _mm_set1_epi32(127));
+    f4 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x7FFFFF)),
+                                         _mm_set1_epi32(0x3F800000)));
+    auto big = m > 1.41421356f;
+    m = select(big, m * 0.5f, m);
+    f4 exf = f4(_mm_cvtepi32_ps(ex)) + (big & 1.0f);
+    auto y = max(-127.0f, min(127.0f, e * (exf + log2poly((m - 1.0f) / (m + 1.0f)))));
+    auto n = _mm_cvttps_epi32(y.v);
+    f4 nf = _mm_cvtepi32_ps(n);
+    auto rounddown = y < nf;  // _mm_cvttps_epi32 truncates towards 0, we want floor
+    n = _mm_add_epi32(n, _mm_castps_si128(rounddown.v));
+    nf = nf - (rounddown & 1.0f);
+    f4 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+    return (x > 0.0f) & (y > -126.0f) & (exp2poly(y - nf - 0.5f) * scale);
+}
+
+#else
+
+struct f4
+{
+    float v[4];
+
+    f4() {}
+    f4(float f) { for (int i = 0; i < 4; i++) v[i] = f; }
+
+    static f4 Load(const float *p) { f4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+};
+
+#define F4OP(NAME, EXP) \
+    inline f4 NAME(const f4 &a, const f4 &b) { f4 r; for (int i = 0; i < 4; i++) r.v[i] = EXP; return r; }
+F4OP(operator+, a.v[i] + b.v[i])
+F4OP(operator-, a.v[i] - b.v[i])
+F4OP(operator*, a.v[i] * b.v[i])
+F4OP(operator/, a.v[i] / b.v[i])
+F4OP(operator<,  a.v[i] <  b.v[i])
+F4OP(operator<=, a.v[i] <= b.v[i])
+F4OP(operator>,  a.v[i] >  b.v[i])
+F4OP(operator>=, a.v[i] >= b.v[i])
+F4OP(operator&, a.v[i] != 0 && b.v[i] != 0 ? b.v[i] : 0)
+F4OP(min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+F4OP(max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+F4OP(fastpow, fastpow(a.v[i], b.v[i]))
+#undef F4OP
+
+inline f4 select(const f4 &mask, const f4 &a, const f4 &b)
+{
+    f4 r;
+    for (int i = 0; i < 4; i++) r.v[i] = mask.v[i] != 0 ? a.v[i] : b.v[i];
+    return r;
+}
+
+inline f4 abs(const f4 &a) { f4 r; for (int i = 0; i < 4; i++) r.v[i] = fabsf(a.v[i]); return r; }
+inline f4 sqrt(const f4 &a) { f4 r; for (int i = 0; i < 4; i++) r.v[i] = sqrtf(a.v[i]); return r; }
+
+inline void StoreMask(uchar *dest, const f4 &mask) { for (int i = 0; i < 4; i++) dest[i] = mask.v[i] != 0; }
+
+#endif
+
+// batches given to EvalBatch are padded to a multiple of 4 points
+inline int PadBatch(int n) { return (n + 3) & ~3; }
+
 // use curiously recurring template pattern to allow implicit function to be inlined in rasterization loop
 
 template<typename T> struct ImplicitFunctionImpl : ImplicitFunction
 {
-    void FillGrid(const int3 &start, const int3 &end, const int3 &gridsize, findex *fcellindices,
-                  vector<fcell> &fcells, const float3 &gridscale, const float3 &gridtrans, const float3x3 &gridrot)
+    // Evaluates n points at once, given as separate x, y and z arrays padded to PadBatch(n). Shapes override this
+    // using Batch() below, the default just calls Eval for each.
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        for (int i = 0; i < n; i++) inside[i] = static_cast<T *>(this)->Eval(float3(x[i], y[i], z[i]));
+    }
+
+    template<typename F> static void Batch(const float *x, const float *y, const float *z, uchar *inside, int n,
+                                           const F &f)
+    {
+        for (int i = 0; i < n; i += 4) StoreMask(inside + i, f(f4::Load(x + i), f4::Load(y + i), f4::Load(z + i)));
+    }
+
+    // a cell whose solidity differs from its neighbor along axis, where the surface position still needs refining
+    struct Crossing
+    {
+        int zi, axis, tmat, omat;
+        float3 solidpos, emptypos;
+    };
+
+    void FillGrid(const int3 &start, const int3 &end, const int3 &gridsize, BrickGrid<findex> &grid,
+                  GridSlab &slab, const float3 &gridscale, const float3 &gridtrans, const float3x3 &gridrot)
     {
         assert(end <= gridsize && int3(0) <= start);
 
-        for (int x = start.x(); x < end.x(); x++)
-            for (int y = start.y(); y < end.y(); y++)
-                for (int z = start.z(); z < end.z(); z++)
+        auto &fcells = slab.fcells;
+
+        // Works a row along z at a time: evaluates all its cells in one batch, then refines all the surface crossings
+        // found in one batch per bisection step. Keeps which cells were inside this shape and their grid values for
+        // the current and previous x layer, so neighbors don't need evaluating or looking up again.
+        auto ny = end.y() - start.y(), nz = end.z() - start.z(), rowstride = PadBatch(nz);
+        vector<uchar> layer(ny * rowstride), prevlayer(ny * rowstride);
+        vector<float> px(rowstride), py(rowstride), pz(rowstride);
+        vector<findex> flayer(ny * nz), prevflayer(ny * nz), oldrow(nz), xedge(nz), yedge(nz);
+        vector<Crossing> crossings;
+        vector<float3> p1f, p2f;
+        vector<float> bx, by, bz;
+        vector<uchar> binside;
+
+        auto gridtoshape = [&](const float3 &gpos)
         {
-            int3 ipos(x, y, z);
-
-            auto pos = float3(ipos);
+            auto pos = gpos;
             pos -= gridtrans;
             pos = pos * gridrot;
             pos /= gridscale;
-            bool inside = static_cast<T *>(this)->Eval(pos);
+            return pos;
+        };
 
-            // bounding box is supposed to cover the entire shape with 1 empty cell surrounding in all directions
-            assert(!inside || (ipos > start && ipos < end - 1));
+        auto xbegin = max(start.x(), slab.x0 - 1), xend = min(end.x(), slab.x1);
+        for (int x = xbegin; x < xend; x++)
+        {
+            layer.swap(prevlayer);
+            flayer.swap(prevflayer);
 
-            findex &fi = fcellindices[IndexGrid(ipos, gridsize)];
-            int tmat = fi.getm();
-            if (inside)
+            for (int y = start.y(); y < end.y(); y++)
             {
-                tmat = material;
-                fi.setm(tmat);
-            }
+                auto rowinside = &layer[(y - start.y()) * rowstride];
+                auto row = &flayer[(y - start.y()) * nz];
 
-            for (int i = 0; i < 3; i++)
-            {
-                int3 opos = ipos - axesi[i];
-                if (opos[i] >= 0)
+                for (int zi = 0; zi < nz; zi++)
                 {
-                    findex &fio = fcellindices[IndexGrid(opos, gridsize)];
-                    int omat = fio.getm();
+                    auto pos = gridtoshape(float3(int3(x, y, start.z() + zi)));
+                    px[zi] = pos.x();
+                    py[zi] = pos.y();
+                    pz[zi] = pos.z();
+                }
+                static_cast<T *>(this)->EvalBatch(px.data(), py.data(), pz.data(), rowinside, nz);
 
-                    if ((omat != 0) != (tmat != 0))
+                if (x < slab.x0)
+                {
+                    // the previous slab owns this layer, all we need from it is the material, which it sets the same way
+                    for (int zi = 0; zi < nz; zi++)
                     {
-                        // FIXME: factor this out, or make cell lookup
-                        if (inside || static_cast<T *>(this)->Eval(pos - (axesf[i] * gridrot) / gridscale))
-                        {
-                            auto solidpos = float3(tmat ? ipos : opos);
-                            auto emptypos = float3(tmat ? opos : ipos);
-                            auto p1f = solidpos;
-                            auto p2f = emptypos;
-                            float iso;
-                            for (int j = 0; ; j++)
-                            {
-                                auto p = (p1f + p2f) / 2;
-                                if (j == 10) { iso = dot(p - solidpos, emptypos - solidpos); break; }
+                        auto &g = slab.ghost[y * gridsize.z() + start.z() + zi];
+                        if (rowinside[zi]) g.setm(material);
+                        row[zi] = g;
+                    }
+                    continue;
+                }
 
-                                auto p2 = p;
-                                p2 -= gridtrans;
-                                p2 = p2 * gridrot;
-                                p2 /= gridscale;
+                // the neighbors at x - 1 and y - 1, from the previous layer and row where those were ours
+                findex *xnbr = &prevflayer[(y - start.y()) * nz];
+                if (x == xbegin && x > 0)
+                {
+                    if (x - 1 < slab.x0)
+                        for (int zi = 0; zi < nz; zi++) xedge[zi] = slab.ghost[y * gridsize.z() + start.z() + zi];
+                    else
+                        grid.GetRow(int3(x - 1, y, start.z()), nz, xedge.data());
+                    xnbr = xedge.data();
+                }
+                findex *ynbr = row - nz;
+                if (y == start.y() && y > 0)
+                {
+                    grid.GetRow(int3(x, y - 1, start.z()), nz, yedge.data());
+                    ynbr = yedge.data();
+                }
 
-                                if (static_cast<T *>(this)->Eval(p2) == (material != 0)) p1f = p;
-                                else                                                 p2f = p;
-                            }
+                auto znbr = start.z() > 0 ? grid.Get(int3(x, y, start.z() - 1)) : findex();
 
-                            auto e = int(iso * maxedge);
-                            assert(iso >= 0 && iso <= 1);
-                            e = max(1, min(maxedge - 1, e));
+                grid.GetRow(int3(x, y, start.z()), nz, row);
+                for (int zi = 0; zi < nz; zi++) oldrow[zi] = row[zi];
 
-                            if (!fi.geti())
-                            {
-                                fi.seti(fcells.size());
-                                fcells.push_back(fcell());
-                            }
+                crossings.clear();
+
+                for (int zi = 0; zi < nz; zi++)
+                {
+                    int3 ipos(x, y, start.z() + zi);
+                    bool inside = rowinside[zi] != 0;
+
+                    // bounding box is supposed to cover the entire shape with 1 empty cell surrounding in all
+                    // directions, so anything outside of it is outside the shape
+                    assert(!inside || (ipos > start && ipos < end - 1));
+
+                    findex &fi = row[zi];
+                    int tmat = fi.getm();
+                    if (inside)
+                    {
+                        tmat = material;
+                        fi.setm(tmat);
+                    }
 
-                            fcell &fc = fcells[fi.geti()];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        int3 opos = ipos - axesi[i];
+                        if (opos[i] >= 0)
+                        {
+                            int omat = (i == 0 ? xnbr[zi] : i == 1 ? ynbr[zi] : zi ? row[zi - 1] : znbr).getm();
 
-                            if (fc.edges[i])
+                            if ((omat != 0) != (tmat != 0))
                             {
-                                int oe = tmat ? maxedge - fc.edges[i] : fc.edges[i];
-                                e = material ? max(e, oe) : min(e, oe);
+                                bool oinside = i == 0 ? x > xbegin && prevlayer[(y - start.y()) * rowstride + zi]
+                                             : i == 1 ? y > start.y() && layer[(y - 1 - start.y()) * rowstride + zi]
+                                                      : zi && rowinside[zi - 1];
+                                if (inside || oinside)
+                                {
+                                    Crossing c;
+                                    c.zi = zi;
+                                    c.axis = i;
+                                    c.tmat = tmat;
+                                    c.omat = omat;
+                                    c.solidpos = float3(tmat ? ipos : opos);
+                                    c.emptypos = float3(tmat ? opos : ipos);
+                                    crossings.push_back(c);
+                                }
+                            }
+                            else
+                            {
+                                fcells[fi.geti()].edges[i] = 0;
                             }
-                            fc.edges[i] = ushort(tmat ? maxedge - e : e);
-                            fc.material[i] = short(tmat ? tmat : omat);  // FIXME: make this depend on who is closer
                         }
                     }
-                    else
+                }
+
+                auto nc = (int)crossings.size();
+                if (nc)
+                {
+                    p1f.resize(nc);
+                    p2f.resize(nc);
+                    bx.resize(PadBatch(nc));
+                    by.resize(PadBatch(nc));
+                    bz.resize(PadBatch(nc));
+                    binside.resize(PadBatch(nc));
+                    for (int c = 0; c < nc; c++)
                     {
-                        fcells[fi.geti()].edges[i] = 0;
+                        p1f[c] = crossings[c].solidpos;
+                        p2f[c] = crossings[c].emptypos;
                     }
+                    for (int j = 0; j < 10; j++)
+                    {
+                        for (int c = 0; c < nc; c++)
+                        {
+                            auto p = gridtoshape((p1f[c] + p2f[c]) / 2);
+                            bx[c] = p.x();
+                            by[c] = p.y();
+                            bz[c] = p.z();
+                        }
+                        static_cast<T *>(this)->EvalBatch(bx.data(), by.data(), bz.data(), binside.data(), nc);
+                        for (int c = 0; c < nc; c++)
+                        {
+                            auto p = (p1f[c] + p2f[c]) / 2;
+                            if ((binside[c] != 0) == (material != 0)) p1f[c] = p;
+                            else                                      p2f[c] = p;
+                        }
+                    }
+                }
+
+                for (int c = 0; c < nc; c++)
+                {
+                    auto &cr = crossings[c];
+                    auto i = cr.axis;
+                    auto p = (p1f[c] + p2f[c]) / 2;
+                    auto iso = dot(p - cr.solidpos, cr.emptypos - cr.solidpos);
+
+                    auto e = int(iso * maxedge);
+                    assert(iso >= 0 && iso <= 1);
+                    e = max(1, min(maxedge - 1, e));
+
+                    findex &fi = row[cr.zi];
+                    if (!fi.geti())
+                    {
+                        fi.seti(fcells.size());
+                        fcells.push_back(fcell());
+                    }
+
+                    fcell &fc = fcells[fi.geti()];
+
+                    if (fc.edges[i])
+                    {
+                        int oe = cr.tmat ? maxedge - fc.edges[i] : fc.edges[i];
+                        e = material ? max(e, oe) : min(e, oe);
+                    }
+                    fc.edges[i] = ushort(cr.tmat ? maxedge - e : e);
+                    fc.material[i] = short(cr.tmat ? cr.tmat : cr.omat);  // FIXME: make this depend on who is closer
                 }
+
+                for (int zi = 0; zi < nz; zi++)
+                    if (row[zi] != oldrow[zi]) grid.Ref(int3(x, y, start.z() + zi)) = row[zi];
             }
+
+            // once done with a layer of bricks this shape won't write to them anymore, so any it made all empty or
+            // all solid can go. only that layer: the ones after it may belong to slabs other threads are filling
+            if (x >= slab.x0 && ((x + 1) % BrickGrid<findex>::B == 0 || x + 1 == xend))
+                grid.Compact(int3(x, start.y(), start.z()), int3(x, end.y() - 1, end.z() - 1));
         }
     }
 };
 
+// The EvalBatch versions below compute the same as Eval, 4 points at a time using f4.
+
 struct IFSphere : ImplicitFunctionImpl<IFSphere>
 {
     inline bool Eval(const float3 &pos) { return dot(pos, pos) <= 1; }
+
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "sphere");
+        ImplicitFunction::Hash(h);
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        Batch(x, y, z, inside, n, [](const f4 &x, const f4 &y, const f4 &z)
+        {
+            return x * x + y * y + z * z <= 1.0f;
+        });
+    }
 };
 
 struct IFCube : ImplicitFunctionImpl<IFCube>
 {
     inline bool Eval(const float3 &pos) { return abs(pos) <= 1; }
+
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "cube");
+        ImplicitFunction::Hash(h);
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        Batch(x, y, z, inside, n, [](const f4 &x, const f4 &y, const f4 &z)
+        {
+            return (abs(x) <= 1.0f) & (abs(y) <= 1.0f) & (abs(z) <= 1.0f);
+        });
+    }
 };
 
 struct IFCylinder : ImplicitFunctionImpl<IFCylinder>
@@ -204,12 +636,34 @@ struct IFCylinder : ImplicitFunctionImpl<IFCylinder>
     {
         return pos.z() <= 1 && pos.z() >= -1 && dot(pos.xy(), pos.xy()) <= 1;
     }
+
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "cylinder");
+        ImplicitFunction::Hash(h);
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        Batch(x, y, z, inside, n, [](const f4 &x, const f4 &y, const f4 &z)
+        {
+            return (z <= 1.0f) & (z >= -1.0f) & (x * x + y * y <= 1.0f);
+        });
+    }
 };
 
 struct IFTaperedCylinder : ImplicitFunctionImpl<IFTaperedCylinder>
 {
     float bot, top;
 
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "tapered_cylinder");
+        HashValue(h, bot);
+        HashValue(h, top);
+        ImplicitFunction::Hash(h);
+    }
+
     inline bool Eval(const float3 &pos)
     {
         auto xy = pos.xy();
@@ -217,6 +671,17 @@ struct IFTaperedCylinder : ImplicitFunctionImpl<IFTaperedCylinder>
         return pos.z() <= 1 && pos.z() >= -1 && dot(xy, xy) <= r * r;
     }
 
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        f4 b = bot, t = top;
+        Batch(x, y, z, inside, n, [&](const f4 &x, const f4 &y, const f4 &z)
+        {
+            auto f = z / 2.0f + 0.5f;
+            auto r = b * (1.0f - f) + t * f;
+            return (z <= 1.0f) & (z >= -1.0f) & (x * x + y * y <= r * r);
+        });
+    }
+
     float3 ComputeSize()
     {
         auto rad = max(top, bot);
@@ -224,15 +689,29 @@ struct IFTaperedCylinder : ImplicitFunctionImpl<IFTaperedCylinder>
     }
 };
 
-// TODO: pow is rather slow...
-
 struct IFSuperQuadric : ImplicitFunctionImpl<IFSuperQuadric>
 {
     float3 exp;
 
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "superquadric");
+        HashValue(h, exp);
+        ImplicitFunction::Hash(h);
+    }
+
     inline bool Eval(const float3 &pos)
     {
-        return dot(pow(abs(pos), exp), float3_1) <= 1;
+        return dot(fastpow(abs(pos), exp), float3_1) <= 1;
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        f4 ex = exp.x(), ey = exp.y(), ez = exp.z();
+        Batch(x, y, z, inside, n, [&](const f4 &x, const f4 &y, const f4 &z)
+        {
+            return fastpow(abs(x), ex) + fastpow(abs(y), ey) + fastpow(abs(z), ez) <= 1.0f;
+        });
     }
 };
 
@@ -241,11 +720,29 @@ struct IFSuperToroid : ImplicitFunctionImpl<IFSuperToroid>
     float r;
     float3 exp;
 
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "supertoroid");
+        HashValue(h, r);
+        HashValue(h, exp);
+        ImplicitFunction::Hash(h);
+    }
+
     inline bool Eval(const float3 &pos)
     {
-        auto p = pow(abs(pos), exp);
+        auto p = fastpow(abs(pos), exp);
         auto xy = r - sqrtf(p.x() + p.y());
-        return powf(fabsf(xy), exp.z()) + p.z() <= 1;
+        return fastpow(fabsf(xy), exp.z()) + p.z() <= 1;
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        f4 ex = exp.x(), ey = exp.y(), ez = exp.z(), rad = r;
+        Batch(x, y, z, inside, n, [&](const f4 &x, const f4 &y, const f4 &z)
+        {
+            auto xy = rad - sqrt(fastpow(abs(x), ex) + fastpow(abs(y), ey));
+            return fastpow(abs(xy), ez) + fastpow(abs(z), ez) <= 1.0f;
+        });
     }
 
     float3 ComputeSize() { return size * float3(r * 2 + 1, r * 2 + 1, 1); }
@@ -256,12 +753,40 @@ struct IFSuperQuadricNonUniform : ImplicitFunctionImpl<IFSuperQuadricNonUniform>
     float3 exppos, expneg;
     float3 scalepos, scaleneg;
 
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "superquadric_non_uniform");
+        HashValue(h, exppos);
+        HashValue(h, expneg);
+        HashValue(h, scalepos);
+        HashValue(h, scaleneg);
+        ImplicitFunction::Hash(h);
+    }
+
     inline bool Eval(const float3 &pos)
     {
         auto d = pos.iflt(0, scaleneg, scalepos);
         auto e = pos.iflt(0, expneg, exppos);
         auto p = abs(pos) / d;
-        return p < 1 && dot(pow(p, e), float3_1) <= 1;
+        return p < 1 && dot(fastpow(p, e), float3_1) <= 1;
+    }
+
+    void EvalBatch(const float *x, const float *y, const float *z, uchar *inside, int n)
+    {
+        f4 dnx = scaleneg.x(), dny = scaleneg.y(), dnz = scaleneg.z();
+        f4 dpx = scalepos.x(), dpy = scalepos.y(), dpz = scalepos.z();
+        f4 enx = expneg.x(), eny = expneg.y(), enz = expneg.z();
+        f4 epx = exppos.x(), epy = exppos.y(), epz = exppos.z();
+        Batch(x, y, z, inside, n, [&](const f4 &x, const f4 &y, const f4 &z)
+        {
+            auto nx = x < 0.0f, ny = y < 0.0f, nz = z < 0.0f;
+            auto px = abs(x) / select(nx, dnx, dpx);
+            auto py = abs(y) / select(ny, dny, dpy);
+            auto pz = abs(z) / select(nz, dnz, dpz);
+            return (px < 1.0f) & (py < 1.0f) & (pz < 1.0f) &
+                   (fastpow(px, select(nx, enx, epx)) + fastpow(py, select(ny, eny, epy)) +
+                    fastpow(pz, select(nz, enz, epz)) <= 1.0f);
+        });
     }
 
     float3 ComputeSize() { return size * max(scalepos, scaleneg); }
@@ -277,6 +802,14 @@ struct Group : ImplicitFunctionImpl<Group>
         for (auto c : children) delete c;
     }
 
+    // A group has no transform of its own, its orig is only computed by ComputeSize.
+    void Hash(SHA256 &h)
+    {
+        HashTag(h, "group");
+        HashValue(h, (int)children.size());
+        for (auto c : children) c->Hash(h);
+    }
+
     static inline bool Eval(const float3 & /*pos*/) { return false; }
 
     float3 ComputeSize()
@@ -294,8 +827,8 @@ struct Group : ImplicitFunctionImpl<Group>
         return sz;
     }
 
-    void FillGrid(const int3 & /*start*/, const int3 & /*end*/, const int3 &gridsize, findex *fcellindices,
-                  vector<fcell> &fcells, const float3 &gridscale, const float3 &gridtrans, const float3x3 & /*gridrot*/)
+    void FillGrid(const int3 & /*start*/, const int3 & /*end*/, const int3 &gridsize, BrickGrid<findex> &grid,
+                  GridSlab &slab, const float3 &gridscale, const float3 &gridtrans, const float3x3 & /*gridrot*/)
     {
         for (auto c : children)
         {
@@ -310,26 +843,346 @@ struct Group : ImplicitFunctionImpl<Group>
 
                 auto rsize = rotated_size(c->rot, c->ComputeSize());
 
-                auto start = int3(trans - rsize * gridscale - 0.01f);
-                auto end   = int3(trans + rsize * gridscale + 2.01f);
+                auto start = int3(trans - rsize * gridscale - 0.01f);
+                auto end   = int3(trans + rsize * gridscale + 2.01f);
+
+                auto bs    = end - start;
+
+                if (bs > 1) c->FillGrid(start, end, gridsize, grid, slab, scale, trans, c->rot);
+            }
+        }
+    }
+};
+
+float noisestretch = 1;
+float noiseintensity = 0;
+float randomizeverts = 0;
+
+int polygonizethreads = 0;
+
+int polyreductionpasses = 100;
+float epsilon = 0.98f;
+float maxtricornerdot = 0.95f;
+float polyreductionmaxerror = 0.1f;  // in grid cells
+float polyreductiontarget = 0;       // fraction of the triangles to keep, 0 for only the error bound
+
+struct Quadric
+{
+    double q[11];  // symmetric 4x4: xx xy xz xw yy yz yw zz zw ww, then the number of planes
+
+    Quadric() { memset(q, 0, sizeof(q)); }
+
+    Quadric(const float3 &n, float d)
+    {
+        double a = n.x(), b = n.y(), c = n.z(), w = d;
+        q[0] = a * a; q[1] = a * b; q[2] = a * c; q[3] = a * w;
+        q[4] = b * b; q[5] = b * c; q[6] = b * w;
+        q[7] = c * c; q[8] = c * w;
+        q[9] = w * w;
+        q[10] = 1;
+    }
+
+    void operator+=(const Quadric &o) { for (int i = 0; i < 11; i++) q[i] += o.q[i]; }
+
+    // mean squared distance to the planes
+    double Error(const float3 &p) const
+    {
+        double x = p.x(), y = p.y(), z = p.z();
+        return (q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                             +     q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                                                +     q[7] * z * z + 2 * q[8] * z
+                                                                   +     q[9]) / max(q[10], 1.0);
+    }
+
+    // the position with the smallest error, if the quadric isn't degenerate (all planes parallel or along one line)
+    bool Optimal(float3 &p) const
+    {
+        double a = q[0], b = q[1], c = q[2], d = q[4], e = q[5], f = q[7];
+        double det = a * (d * f - e * e) - b * (b * f - e * c) + c * (b * e - d * c);
+        if (fabs(det) < 1e-9 * q[10] * q[10] * q[10]) return false;
+        double x = -q[3], y = -q[6], z = -q[8];
+        p = float3(float((x * (d * f - e * e) - b * (y * f - e * z) + c * (y * e - d * z)) / det),
+                   float((a * (y * f - e * z) - x * (b * f - e * c) + c * (b * z - y * c)) / det),
+                   float((a * (d * z - y * e) - b * (b * z - y * c) + x * (b * e - d * c)) / det));
+        return true;
+    }
+};
+
+// Garland & Heckbert style simplification: every vertex accumulates a quadric measuring the squared distance to the
+// planes of its original triangles, and edges are collapsed cheapest first until the RMS distance would exceed
+// maxerror or only targettris triangles are left. Rather than keeping one big priority queue up to date, which is
+// dominated by cache misses, each pass orders all edges within maxerror by cost and does as many as it can in that
+// order, leaving verts already changed in this pass for the next one. A handful of passes does nearly all of it.
+// Collapses that would tilt a triangle's normal beyond mindot, or make a triangle thinner than maxcornerdot allows,
+// are skipped, as are boundary vertices and collapses that would make the mesh non-manifold. Merged verts get the
+// average color. Dead verts are left in place, with their triangles removed from the index list.
+// If quadrics is empty it starts from the planes of the current triangles, otherwise it continues with the quadrics
+// of an earlier call on the same verts, so the error stays relative to the mesh before the first call.
+// Returns the largest error of any collapse done (0 if none).
+template<typename T> float simplify_mesh(vector<int> &triangles, vector<T> &verts, vector<Quadric> &quadrics,
+                                         float maxerror, int targettris, float mindot, float maxcornerdot)
+{
+    auto nverts = (int)verts.size();
+    auto ntris = (int)triangles.size() / 3;
+    vector<int> vtstart(nverts + 1), vtris;  // triangles (as index into triangles / 3) around each vert
+    vector<bool> locked(nverts, false);
+
+    auto normal = [](const float3 &a, const float3 &b, const float3 &c) { return cross(c - a, b - a); };
+
+    // worst (largest) cosine of the 3 corners
+    auto cornerdot = [](const float3 &a, const float3 &b, const float3 &c)
+    {
+        auto ab = normalize(b - a), ac = normalize(c - a), bc = normalize(c - b);
+        return max(dot(ab, ac), max(dot(-ab, bc), dot(-ac, -bc)));
+    };
+
+    auto hasvert = [&](int t, int v)
+    {
+        return triangles[t * 3] == v || triangles[t * 3 + 1] == v || triangles[t * 3 + 2] == v;
+    };
+
+    // collapses kill triangles by setting their first index to -1
+    auto buildadjacency = [&]()
+    {
+        fill(vtstart.begin(), vtstart.end(), 0);
+        for (size_t i = 0; i < triangles.size(); i += 3) if (triangles[i] >= 0)
+            for (int j = 0; j < 3; j++) vtstart[triangles[i + j] + 1]++;
+        for (int v = 0; v < nverts; v++) vtstart[v + 1] += vtstart[v];
+        vtris.resize(vtstart[nverts]);
+        auto pos = vtstart;
+        for (size_t i = 0; i < triangles.size(); i += 3) if (triangles[i] >= 0)
+            for (int j = 0; j < 3; j++) vtris[pos[triangles[i + j]]++] = int(i / 3);
+    };
+
+    // number of live triangles on edge a-b
+    auto edgetris = [&](int a, int b)
+    {
+        int n = 0;
+        for (int j = vtstart[a]; j < vtstart[a + 1]; j++) n += triangles[vtris[j] * 3] >= 0 && hasvert(vtris[j], b);
+        return n;
+    };
+
+    // the verts sharing a live triangle with v
+    auto neighbors = [&](int v, vector<int> &ns)
+    {
+        ns.clear();
+        for (int j = vtstart[v]; j < vtstart[v + 1]; j++)
+        {
+            auto t = vtris[j];
+            if (triangles[t * 3] < 0) continue;
+            for (int i = 0; i < 3; i++)
+            {
+                auto w = triangles[t * 3 + i];
+                if (w != v && find(ns.begin(), ns.end(), w) == ns.end()) ns.push_back(w);
+            }
+        }
+    };
+
+    // checks the live triangles around v that don't also use other, if v moves to pos
+    auto keepsshape = [&](int v, int other, const float3 &pos)
+    {
+        for (int j = vtstart[v]; j < vtstart[v + 1]; j++)
+        {
+            auto t = vtris[j];
+            if (triangles[t * 3] < 0 || hasvert(t, other)) continue;
+            float3 p[3], np[3];
+            for (int i = 0; i < 3; i++)
+            {
+                p[i] = verts[triangles[t * 3 + i]].pos;
+                np[i] = triangles[t * 3 + i] == v ? pos : p[i];
+            }
+            auto n = normal(p[0], p[1], p[2]), nn = normal(np[0], np[1], np[2]);
+            auto nnlen = length(nn);
+            if (nnlen < 1e-12f || dot(normalize(n), nn / nnlen) < mindot) return false;
+            auto cd = cornerdot(np[0], np[1], np[2]);
+            if (cd > maxcornerdot && cd > cornerdot(p[0], p[1], p[2])) return false;
+        }
+        return true;
+    };
+
+    // where a and b would merge, and the error that gives
+    auto collapsepos = [&](int a, int b, float3 &pos)
+    {
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        auto &pa = verts[a].pos, &pb = verts[b].pos;
+        auto pm = (pa + pb) / 2;
+        // on (nearly) flat areas the optimum is badly conditioned and can lie anywhere in the plane
+        if (!q.Optimal(pos) || length(pos - pm) > length(pb - pa))
+        {
+            // pick the best of the endpoints and midpoint instead
+            auto ea = q.Error(pa), eb = q.Error(pb), em = q.Error(pm);
+            pos = ea < eb ? (ea < em ? pa : pm) : (eb < em ? pb : pm);
+        }
+        return max(0.0, q.Error(pos));
+    };
+
+    if (quadrics.empty())
+    {
+        quadrics.resize(nverts);
+        for (int t = 0; t < ntris; t++)
+        {
+            auto &p1 = verts[triangles[t * 3 + 0]].pos;
+            auto n = normalize(normal(p1, verts[triangles[t * 3 + 1]].pos, verts[triangles[t * 3 + 2]].pos));
+            Quadric q(n, -dot(n, p1));
+            for (int i = 0; i < 3; i++) quadrics[triangles[t * 3 + i]] += q;
+        }
+    }
+    assert((int)quadrics.size() == nverts);
+
+    buildadjacency();
+
+    // edges used by only one triangle are on a hole in the mesh, keep those verts so the hole doesn't grow
+    for (int t = 0; t < ntris * 3; t += 3)
+        for (int i = 0; i < 3; i++)
+        {
+            int a = triangles[t + i], b = triangles[t + (i + 1) % 3];
+            if (edgetris(a, b) != 2) locked[a] = locked[b] = true;
+        }
+
+    struct Collapse
+    {
+        float error, len;
+        int a, b;
+    };
+
+    auto maxerror2 = double(maxerror) * maxerror;
+    auto alive = ntris;
+    double worst = 0;
+    vector<Collapse> collapses, sorted;
+    vector<int> na, nb;
+    vector<bool> touched(nverts);
+
+    // Collapses are only roughly ordered, in buckets by error and then by edge length, and otherwise stay in the order
+    // of the triangles. Going through them fully sorted jumps all over the mesh, which is much slower. Shorter edges
+    // first matters on flat areas, where all errors are about 0, since going in mesh order there leaves thin
+    // triangles that then block further collapses.
+    const int errbuckets = 64, lenbuckets = 16, numbuckets = errbuckets * lenbuckets;
+    int bucketstart[numbuckets + 1];
+    float lenscale = 1;
+    auto bucket = [&](const Collapse &c)
+    {
+        return min(errbuckets - 1, int(sqrt(c.error / maxerror2) * errbuckets)) * lenbuckets +
+               min(lenbuckets - 1, int(c.len * lenscale));
+    };
+
+    for (;;)
+    {
+        // each edge once, from the triangle where it goes from low to high index
+        collapses.clear();
+        for (size_t i = 0; i < triangles.size(); i += 3)
+            for (int j = 0; j < 3; j++)
+            {
+                int a = triangles[i + j], b = triangles[i + (j + 1) % 3];
+                if (a > b || locked[a] || locked[b]) continue;
+                float3 pos;
+                Collapse c = { float(collapsepos(a, b, pos)), length(verts[a].pos - verts[b].pos), a, b };
+                if (c.error <= maxerror2) collapses.push_back(c);
+            }
+        if (collapses.empty()) break;
+
+        // the average length goes in the middle bucket
+        double totallen = 0;
+        for (auto &c : collapses) totallen += c.len;
+        lenscale = totallen > 0 ? float(lenbuckets / 2 * collapses.size() / totallen) : 1;
+
+        memset(bucketstart, 0, sizeof(bucketstart));
+        for (auto &c : collapses) bucketstart[bucket(c) + 1]++;
+        for (int i = 0; i < numbuckets; i++) bucketstart[i + 1] += bucketstart[i];
+        sorted.resize(collapses.size());
+        for (auto &c : collapses) sorted[bucketstart[bucket(c)]++] = c;
+
+        fill(touched.begin(), touched.end(), false);
+        int collapsed = 0;
+        for (auto &c : sorted)
+        {
+            if (alive <= targettris) break;
+            int a = c.a, b = c.b;
+            if (touched[a] || touched[b]) continue;
+
+            // only collapse an edge with a triangle on each side, whose ends share no other neighbors, otherwise the
+            // mesh would fold onto itself
+            if (edgetris(a, b) != 2) continue;
+            neighbors(a, na);
+            neighbors(b, nb);
+            int common = 0;
+            for (auto w : na) common += find(nb.begin(), nb.end(), w) != nb.end();
+            if (common != 2) continue;
+
+            float3 pos;
+            collapsepos(a, b, pos);
+            if (!keepsshape(a, b, pos) || !keepsshape(b, a, pos)) continue;
+
+            // move b into a
+            verts[a].pos = pos;
+            verts[a].col = byte4((int4(verts[a].col) + int4(verts[b].col)) / 2);
+            quadrics[a] += quadrics[b];
+            touched[a] = touched[b] = true;
+            worst = max(worst, (double)c.error);
+            for (int j = vtstart[b]; j < vtstart[b + 1]; j++)
+            {
+                auto t = vtris[j];
+                if (triangles[t * 3] < 0) continue;
+                if (hasvert(t, a))
+                {
+                    triangles[t * 3] = -1;
+                    alive--;
+                }
+                else
+                {
+                    for (int i = 0; i < 3; i++) if (triangles[t * 3 + i] == b) triangles[t * 3 + i] = a;
+                }
+            }
+            collapsed++;
+        }
+
+        size_t writep = 0;
+        for (size_t i = 0; i < triangles.size(); i += 3) if (triangles[i] >= 0)
+            for (int j = 0; j < 3; j++) triangles[writep++] = triangles[i + j];
+        triangles.erase(triangles.begin() + writep, triangles.end());
 
-                auto bs    = end - start;
+        // stop when it is down to the few collapses that keep failing the checks above
+        if (collapsed * 50 < alive || alive <= targettris) break;
+        buildadjacency();
+    }
+    return float(sqrt(worst));
+}
 
-                if (bs > 1) c->FillGrid(start, end, gridsize, fcellindices, fcells, scale, trans, c->rot);
-            }
+// Removes the verts no triangle uses anymore, like the ones simplify_mesh leaves behind.
+template<typename T> void remove_unused_verts(vector<int> &triangles, vector<T> &verts)
+{
+    vector<int> vertmap(verts.size(), -1);
+    for (size_t t = 0; t < triangles.size(); t++) vertmap[triangles[t]]++;
+    size_t ni = 0;
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        if (vertmap[i] >= 0)
+        {
+            verts[ni] = verts[i];
+            vertmap[i] = ni++;
         }
     }
+    verts.erase(verts.begin() + ni, verts.end());
+    for (size_t t = 0; t < triangles.size(); t++) triangles[t] = vertmap[triangles[t]];
+}
+
+struct mgvert  // any changes to this struct must be reflected in recompute_normals and MakeMesh below
+{
+    float3 pos;
+    float3 norm;
+    byte4 col;
 };
 
-float noisestretch = 1;
-float noiseintensity = 0;
-float randomizeverts = 0;
+// What polygonize_mc produces, before it becomes a Mesh. This is also what the mesh cache stores.
+struct MeshGenData
+{
+    vector<mgvert> verts;
+    vector<int> triangles;
 
-int polyreductionpasses = 100;
-float epsilon = 0.98f;
-float maxtricornerdot = 0.95f;
+    size_t Bytes() const { return verts.size() * sizeof(mgvert) + triangles.size() * sizeof(int); }
+};
 
-int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float3> &materials)
+void polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float3> &materials, MeshGenData &out)
 {
     auto scenesize = root->ComputeSize() * 2;
 
@@ -338,19 +1191,40 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
     auto gridscale = targetgridsize / biggestdim;
 
     auto gridsize = int3(scenesize * gridscale + float3(2.5f));
-    auto gridcount = gridsize.x() * gridsize.y() * gridsize.z();
 
     auto gridtrans = (float3(gridsize) - 1) / 2 - root->orig * gridscale;
 
-    auto fcellindices = new findex[gridcount];
-    memset(fcellindices, 0, gridcount * sizeof(findex));
+    BrickGrid<findex> grid(gridsize, findex());
+    const int B = BrickGrid<findex>::B;
+
+    // slabs are whole bricks thick, so no two threads write to the same brick
+    auto nthreads = polygonizethreads > 0 ? polygonizethreads : (int)thread::hardware_concurrency();
+    auto nbricksx = (gridsize.x() + B - 1) / B;
+    auto nslabs = max(1, min(nthreads * 4, nbricksx));
+    vector<GridSlab> slabs(nslabs);
+    for (int s = 0; s < nslabs; s++)
+    {
+        auto &slab = slabs[s];
+        slab.x0 = min(gridsize.x(), nbricksx * s / nslabs * B);
+        slab.x1 = min(gridsize.x(), nbricksx * (s + 1) / nslabs * B);
+        slab.fcells.push_back(fcell());  // index 0 means no per cell data
+    }
 
-    vector<fcell> fcells;
-    fcells.push_back(fcell());  // index 0 means no per cell data
+    auto run = [&](const function<void(int)> &body)
+    {
+        if (nthreads > 1 && nslabs > 1) ParallelFor(nslabs, nthreads, body);
+        else for (int s = 0; s < nslabs; s++) body(s);
+    };
 
     /////////// SAMPLE GRID
 
-    root->FillGrid(int3(0), gridsize, gridsize, fcellindices, fcells, float3(gridscale), gridtrans, float3x3_1);
+    run([&](int s)
+    {
+        auto &slab = slabs[s];
+        if (s) slab.ghost.resize(gridsize.y() * gridsize.z());
+        root->FillGrid(int3(0), gridsize, gridsize, grid, slab, float3(gridscale), gridtrans, float3x3_1);
+        vector<findex>().swap(slab.ghost);
+    });
 
     /////////// APPLY MC
 
@@ -362,90 +1236,151 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
         edge(const float3 &_mid, int _m) : mid(_mid), material(_m) {}
     };
 
-    vector<int> mctriangles;
-    vector<edge> edges;
-
-    for (int x = 0; x < gridsize.x() - 1; x++)
-        for (int y = 0; y < gridsize.y() - 1; y++)
-            for (int z = 0; z < gridsize.z() - 1; z++)
+    struct mcslab
     {
-        static int3 gridpos[8];
-        static findex celli[8];
+        vector<edge> edges;
+        vector<int> mctriangles;  // indices into edges
+    };
 
-        int3 pos(x, y, z);
+    vector<mcslab> mcslabs(nslabs);
 
-        int ci = 0;
+    run([&](int s)
+    {
+        auto &slab = slabs[s];
+        auto &edges = mcslabs[s].edges;
+        auto &mctriangles = mcslabs[s].mctriangles;
 
-        static int3 corners[8] =
+        // cubes pos .. pos + (0, 0, B - 1) touch cells up to pos + (1, 1, B), in at most 8 bricks. if those are all
+        // empty or all solid, none of these cubes can produce triangles
+        auto nosurface = [&](const int3 &pos)
         {
-            int3(0, 0, 0),
-            int3(1, 0, 0),
-            int3(1, 1, 0),
-            int3(0, 1, 0),
-            int3(0, 0, 1),
-            int3(1, 0, 1),
-            int3(1, 1, 1),
-            int3(0, 1, 1),
+            int solid = -1;
+            for (int dx = 0; dx < 2; dx++)
+                for (int dy = 0; dy < 2; dy++)
+                    for (int dz = 0; dz < 2; dz++)
+            {
+                findex fi;
+                if (!grid.Uniform(min(pos + int3(dx, dy, dz * B), gridsize - 1) / B, fi)) return false;
+                int bsolid = fi.getm() != 0;
+                if (solid >= 0 && bsolid != solid) return false;
+                solid = bsolid;
+            }
+            return true;
         };
 
-        for (int i = 0; i < 8; i++)
+        for (int x = slab.x0; x < min(slab.x1, gridsize.x() - 1); x++)
+            for (int y = 0; y < gridsize.y() - 1; y++)
+                for (int z = 0; z < gridsize.z() - 1; z++)
         {
-            gridpos[i] = pos + corners[i];
-            celli[i] = fcellindices[IndexGrid(gridpos[i], gridsize)];
+            if (z % B == 0 && nosurface(int3(x, y, z))) { z += B - 1; continue; }
 
-            ci |= (celli[i].getm() != 0) << i;
-        }
+            int3 gridpos[8];
+            findex celli[8];
 
-        if (mc_edge_table[ci] == 0) continue;
+            int3 pos(x, y, z);
 
-        static int vertlist[12];
+            int ci = 0;
 
-        for (int i = 0; i < 12; i++) if (mc_edge_table[ci] & (1<<i))
-        {
-            int i1 = mc_edge_to_vert[i][0];
-            int i2 = mc_edge_to_vert[i][1];
-            int3 &p1 = gridpos[i1];
-            int3 &p2 = gridpos[i2];
+            static const int3 corners[8] =
+            {
+                int3(0, 0, 0),
+                int3(1, 0, 0),
+                int3(1, 1, 0),
+                int3(0, 1, 0),
+                int3(0, 0, 1),
+                int3(1, 0, 1),
+                int3(1, 1, 1),
+                int3(0, 1, 1),
+            };
+
+            for (int i = 0; i < 8; i++)
+            {
+                gridpos[i] = pos + corners[i];
+                celli[i] = grid.Get(gridpos[i]);
+
+                ci |= (celli[i].getm() != 0) << i;
+            }
 
-            int cidx = celli[i2].geti();
-            assert(cidx);
+            if (mc_edge_table[ci] == 0) continue;
 
-            int dir = p1.x() < p2.x() ? 0 : p1.y() < p2.y() ? 1 : 2;
-            fcell &fc = fcells[cidx];
-            int &idx = fc.edgeidx[dir];
-            if (idx < 0)
+            int vertlist[12];
+
+            for (int i = 0; i < 12; i++) if (mc_edge_table[ci] & (1<<i))
             {
-                idx = edges.size();
+                int i1 = mc_edge_to_vert[i][0];
+                int i2 = mc_edge_to_vert[i][1];
+                int3 &p1 = gridpos[i1];
+                int3 &p2 = gridpos[i2];
+
+                int cidx = celli[i2].geti();
+                assert(cidx);
+
+                int dir = p1.x() < p2.x() ? 0 : p1.y() < p2.y() ? 1 : 2;
+                // edges belong to the cell at p2, which for the last layer of cubes is in the next slab, whose own
+                // edge indices we can't touch
+                bool own = p2.x() < slab.x1;
+                fcell &fc = slabs[own ? s : s + 1].fcells[cidx];
+                int &idx = own ? fc.edgeidx[dir]
+                               : slab.nextedges.insert(make_pair((p2.y() * gridsize.z() + p2.z()) * 3 + dir, -1))
+                                     .first->second;
+                if (idx < 0)
+                {
+                    idx = edges.size();
 
-                auto e = fc.edges[dir];
-                assert(e);
-                auto mid = mix(float3(p1), float3(p2), float(e) / maxedge);
+                    auto e = fc.edges[dir];
+                    assert(e);
+                    auto mid = mix(float3(p1), float3(p2), float(e) / maxedge);
 
-                assert(fc.material[dir]);
-                auto material = min(fc.material[dir] - 1, (int)materials.size() - 1);
+                    assert(fc.material[dir]);
+                    auto material = min(fc.material[dir] - 1, (int)materials.size() - 1);
 
-                edges.push_back(edge(mid, material));
+                    edges.push_back(edge(mid, material));
+                }
+                vertlist[i] = idx;
+            }
+
+            for (int i = 0; mc_tri_table[ci][i] != -1; i++)
+            {
+                mctriangles.push_back(vertlist[mc_tri_table[ci][i]]);
             }
-            vertlist[i] = idx;
         }
+    });
 
-        for (int i = 0; mc_tri_table[ci][i] != -1; i++)
+    // Stitch the slabs together. Edges on the first layer of a slab that the previous slab also used are the same
+    // vertex, and keep the index the previous slab gave them. This makes the order identical to doing it in one go.
+
+    vector<int> mctriangles;
+    vector<edge> edges;
+
+    for (int s = 0; s < nslabs; s++)
+    {
+        auto &slab = slabs[s];
+        auto &mcs = mcslabs[s];
+        slab.edgeremap.assign(mcs.edges.size(), -1);
+        if (s)
+        {
+            auto &prev = slabs[s - 1];
+            for (auto &e : prev.nextedges)
+            {
+                auto yz = e.first / 3;
+                auto cidx = grid.Get(int3(slab.x0, yz / gridsize.z(), yz % gridsize.z())).geti();
+                auto idx = slab.fcells[cidx].edgeidx[e.first % 3];
+                if (idx >= 0) slab.edgeremap[idx] = prev.edgeremap[e.second];
+            }
+        }
+        for (size_t i = 0; i < mcs.edges.size(); i++) if (slab.edgeremap[i] < 0)
         {
-            mctriangles.push_back(vertlist[mc_tri_table[ci][i]]);
+            slab.edgeremap[i] = edges.size();
+            edges.push_back(mcs.edges[i]);
         }
+        for (auto i : mcs.mctriangles) mctriangles.push_back(slab.edgeremap[i]);
     }
 
-    delete[] fcellindices;
-
-    struct vert // any changes to this struct must be reflected in recompute_normals below
-    {
-        float3 pos;
-        float3 norm;
-        byte4 col;
-    };
+    mcslabs.clear();
+    slabs.clear();
 
-    vector<int> triangles;
-    vector<vert> verts;
+    auto &triangles = out.triangles;
+    auto &verts = out.verts;
 
     const bool mesh_displacent = true;
     const bool flat_triangles_opt = true;
@@ -471,16 +1406,15 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
             dcell() : accum(float3_0), col(float3_0), n(0) {}
         };
 
-        auto dcellindices = new int[gridcount];
-        memset(dcellindices, -1, gridcount * sizeof(int));
+        BrickGrid<int> dcellindices(gridsize, -1);
 
-        vector<int> iverts;
+        vector<int> iverts;  // the dcell of each edge
         vector<dcell> cells;
 
         for (edge &e : edges)
         {
             int3 ipos(e.mid + 0.5f);
-            int &idx = dcellindices[IndexGrid(ipos, gridsize)];
+            int &idx = dcellindices.Ref(ipos);
 
             if (idx < 0)
             {
@@ -492,7 +1426,7 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
             c.accum += e.mid;
             c.col += materials[e.material];
             c.n--;
-            iverts.push_back(&idx - dcellindices);
+            iverts.push_back(idx);
         }
 
         for (size_t t = 0; t < mctriangles.size(); t += 3)
@@ -506,14 +1440,14 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
             {
                 for (int j = 0; j < 3; j++)
                 {
-                    dcell &c = cells[dcellindices[i[j]]];
+                    dcell &c = cells[i[j]];
                     if (c.n < 0)
                     {
                         c.accum /= (float)-c.n;
                         c.col /= (float)-c.n;
                         c.n = verts.size();
-                        verts.push_back(vert());
-                        vert &v = verts.back();
+                        verts.push_back(mgvert());
+                        mgvert &v = verts.back();
                         v.pos = c.accum;
                         v.norm = float3_0;
                         v.col = quantizec(c.col);
@@ -523,15 +1457,13 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
                 }
             }
         }
-
-        delete[] dcellindices;
     }
     else
     {
         for (edge &e : edges)
         {
-            verts.push_back(vert());
-            vert &v = verts.back();
+            verts.push_back(mgvert());
+            mgvert &v = verts.back();
             v.pos = e.mid;
             v.col = quantizec(materials[e.material]);
             v.norm = float3_0;
@@ -552,9 +1484,9 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
 
         for (size_t t = 0; t < triangles.size(); t += 3)
         {
-            vert &v1 = verts[triangles[t + 0]];
-            vert &v2 = verts[triangles[t + 1]];
-            vert &v3 = verts[triangles[t + 2]];
+            mgvert &v1 = verts[triangles[t + 0]];
+            mgvert &v2 = verts[triangles[t + 1]];
+            mgvert &v3 = verts[triangles[t + 2]];
 
             assert(v1.pos != v2.pos && v1.pos != v3.pos && v2.pos != v3.pos);
 
@@ -606,223 +1538,19 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
         normalize_mesh(&triangles[0], triangles.size(), &verts[0], verts.size(), false);
     };
 
-    recompute_normals();
-
     /////////// POLYGON REDUCTION
 
-    // FIXME: factor out holding triangle data (face normal etc) in arrays
-
     if (polyreductionpasses)
     {
-        int *vertmap = new int[verts.size()];
-
-        for (int prp = 0; prp < polyreductionpasses; prp++)
-        {
-            memset(vertmap, -1, verts.size() * sizeof(int));
-
-            for (size_t t = 0; t < triangles.size(); t += 3)
-            {
-                vert &v1 = verts[triangles[t + 0]];
-                vert &v2 = verts[triangles[t + 1]];
-                vert &v3 = verts[triangles[t + 2]];
-
-                float3 v12u = v2.pos - v1.pos;
-                float3 v13u = v3.pos - v1.pos;
-                float3 d3  = normalize(cross(v13u, v12u));
-
-                for (int i = 0; i < 3; i++)
-                {
-                    if (dot(verts[triangles[t + i]].norm, d3) < epsilon)
-                        vertmap[triangles[t + i]] = -2;     // not available for reduction
-                }
-            }
-
-            for (size_t t = 0; t < triangles.size(); t += 3)
-            {
-                vert &v1 = verts[triangles[t + 0]];
-                vert &v2 = verts[triangles[t + 1]];
-                vert &v3 = verts[triangles[t + 2]];
-
-                float3 v12u = v2.pos - v1.pos;
-                float3 v13u = v3.pos - v1.pos;
-
-                int i1 = -1, i2 = -1, i3 = -1;
-                for (int i = 0; i < 3; i++)
-                {
-                    if (vertmap[triangles[t + i]] == -1)
-                    {
-                        if (i2 < 0)
-                        {
-                            if (i1 >= 0) i2 = i;
-                            else i1 = i;
-                        }
-                    }
-                    else i3 = i;
-                }
-
-                if (i3 < 0)     // all 3 flat, pick the shortest edge
-                {
-                    auto l12 = length(v12u);
-                    auto l13 = length(v13u);
-                    auto l23 = length(v2.pos - v3.pos);
-
-                    if (l13 < l12 && l13 < l23) // pick 13
-                    {
-                        i2 = 2;
-                        i3 = 1;
-                    }
-                    else if (l23 < l12 && l23 < l13)    // pick 23
-                    {
-                        i1 = 1;
-                        i2 = 2;
-                        i3 = 0;
-                    }
-                    else   // pick 12
-                    {
-                        i3 = 2;
-                    }
-                }
-
-                if (i1 >= 0 && i2 >= 0
-                    && vertmap[triangles[t + i3]] < 0  // why is this so important???
-                )
-                {
-                    int vi = triangles[t + i1];
-                    int ovi = triangles[t + i2];
-                    vertmap[vi] = ovi;
-                    vertmap[ovi] = vi;
-                }
-            }
-
-            int flipped = 0;
-            for (size_t t = 0; t < triangles.size(); t += 3)
-            {
-                for (int i = 0; i < 3; i++)
-                {
-                    int vi1 = triangles[t + i];
-                    int vi2 = triangles[t + (i + 1) % 3];
-                    int vi3 = triangles[t + (i + 2) % 3];
-                    if (vertmap[vi1] >= 0 && vertmap[vi1] != vi2 && vertmap[vi1] != vi3)
-                    {
-                        vert &v1 = verts[vi1];
-                        vert &v2 = verts[vi2];
-                        vert &v3 = verts[vi3];
-
-                        float3 d3  = normalize(cross(v3.pos - v1.pos, v2.pos - v1.pos));
-
-                        float3 vm = (verts[vertmap[vi1]].pos + v1.pos) / 2;
-                        float3 v12m = normalize(v2.pos - vm);
-                        float3 v13m = normalize(v3.pos - vm);
-                        float3 v23m = normalize(v3.pos - v2.pos);
-                        float3 d3m  = normalize(cross(v13m, v12m));
-
-                        if (dot(d3, d3m) < epsilon ||
-                            dot(v12m, v13m) > maxtricornerdot ||
-                            dot(-v12m, v23m) > maxtricornerdot ||
-                            dot(-v23m, -v13m) > maxtricornerdot)
-                        {
-                            vertmap[vertmap[vi1]] = -1;
-                            vertmap[vi1] = -1;
-                            flipped++;
-                        }
-                    }
-                }
-            }
-            //Output(OUTPUT_DEBUG, "flipped tris: %d\n", flipped);
-
-            for (size_t t = 0; t < triangles.size(); t += 3)
-            {
-                int keep = -1;
-                for (int i = 0; i < 3; i++)
-                {
-                    int vi = triangles[t + i];
-                    if (vertmap[vi] >= 0)
-                    {
-                        if (keep >= 0)
-                        {
-                            int kvi = triangles[t + keep];
-                            if (vertmap[vi] != kvi)
-                            {
-                                if (length(verts[ vi].pos - verts[vertmap[ vi]].pos) <
-                                    length(verts[kvi].pos - verts[vertmap[kvi]].pos))
-                                {
-                                    vertmap[vertmap[kvi]] = -1;
-                                    vertmap[kvi] = -1;
-                                    keep = i;
-                                }
-                                else
-                                {
-                                    vertmap[vertmap[vi]] = -1;
-                                    vertmap[vi] = -1;
-                                }
-                            }
-                        }
-                        else keep = i;
-                    }
-                }
-            }
-
-            size_t writep = 0;
-            for (size_t t = 0; t < triangles.size(); t += 3)
-            {
-                for (int i = 0; i < 3; i++)
-                {
-                    int target = vertmap[triangles[t + i]];
-                    if (target >= 0)
-                    {
-                        if (triangles[t + (i + 1) % 3] == target || triangles[t + (i + 2) % 3] == target)
-                        {
-                            writep -= i;
-                            break;
-                        }
-                    }
-
-                    triangles[writep++] = triangles[t + i];
-                }
-            }
-            int polysreduced = (triangles.size() - writep) / 3;
-            //Output(OUTPUT_DEBUG, "reduced tris: %d\n", polysreduced);
-            triangles.erase(triangles.begin() + writep, triangles.end());
-
-            for (size_t t = 0; t < triangles.size(); t++)
-            {
-                if (vertmap[triangles[t]] >= 0 && vertmap[triangles[t]] < triangles[t])
-                    triangles[t] = vertmap[triangles[t]];
-            }
-
-            for (size_t i = 0; i < verts.size(); i++) if (vertmap[i] >= 0 && vertmap[i] < (int)i)
-            {
-                vert &v1 = verts[i];
-                vert &v2 = verts[vertmap[i]];
-
-                v2.pos = (v1.pos + v2.pos) / 2;
-                v2.col = byte4((int4(v1.col) + int4(v2.col)) / 2);
-            }
-
-            recompute_normals();
-
-            if (polysreduced < 100)
-                break;
-        }
+        vector<Quadric> quadrics;
+        simplify_mesh(triangles, verts, quadrics, polyreductionmaxerror / gridscale,
+                      int(polyreductiontarget * triangles.size() / 3), epsilon, maxtricornerdot);
 
         // TODO: this also deletes verts from the bad triangle finder, but only if tri reduction is on
-        memset(vertmap, -1, verts.size() * sizeof(int));
-        for (size_t t = 0; t < triangles.size(); t++) vertmap[triangles[t]]++;
-        size_t ni = 0;
-        for (size_t i = 0; i < verts.size(); i++)
-        {
-            if (vertmap[i] >= 0)
-            {
-                verts[ni] = verts[i];
-                vertmap[i] = ni++;
-            }
-        }
-        verts.erase(verts.begin() + ni, verts.end());
-        for (size_t t = 0; t < triangles.size(); t++) triangles[t] = vertmap[triangles[t]];
-
-        delete[] vertmap;
+        remove_unused_verts(triangles, verts);
     }
 
+    recompute_normals();
 
     /////////// APPLY NOISE TO COLOR
 
@@ -852,9 +1580,9 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
 
         for (size_t t = 0; t < triangles.size(); t += 3)
         {
-            vert &v1 = verts[triangles[t + 0]];
-            vert &v2 = verts[triangles[t + 1]];
-            vert &v3 = verts[triangles[t + 2]];
+            mgvert &v1 = verts[triangles[t + 0]];
+            mgvert &v2 = verts[triangles[t + 1]];
+            mgvert &v3 = verts[triangles[t + 2]];
 
             float3 v12 = normalize(v2.pos - v1.pos);
             float3 v13 = normalize(v3.pos - v1.pos);
@@ -879,15 +1607,268 @@ int polygonize_mc(ImplicitFunction *root, const int targetgridsize, vector<float
     //       ulong(edges.size()), ulong(triangles.size()/3), ulong(mctriangles.size()/3), ulong(fcells.size()),
     //       targetgridsize);
 
-    if (verts.empty())
+}
+
+int MakeMesh(MeshGenData &d)
+{
+    if (d.verts.empty())
         return -1;
 
     extern IntResourceManagerCompact<Mesh> *meshes;
-    auto m = new Mesh(new Geometry(&verts[0], verts.size(), sizeof(vert), "PNC"));
-    m->surfs.push_back(new Surface(&triangles[0], triangles.size()));
+    auto m = new Mesh(new Geometry(&d.verts[0], d.verts.size(), sizeof(mgvert), "PNC"));
+    m->surfs.push_back(new Surface(&d.triangles[0], d.triangles.size()));
     return meshes->Add(m);
 }
 
+/////////// LEVELS OF DETAIL
+
+// Makes up to levels - 1 coarser versions of d, each with about ratio times the triangles of the one before, by
+// simplifying further and further rather than polygonizing again. The quadrics carry over from level to level, so
+// errors[i] (the RMS distance of the worst collapse so far) is relative to d itself. The error allowed starts at
+// around the reduction setting and doubles whenever a level can't get down to its triangle count, so the cheapest
+// collapses still go first. Stops early when a level can't get at least halfway to its triangle count.
+void make_lods(MeshGenData &d, int levels, float ratio, vector<MeshGenData> &lods, vector<float> &errors)
+{
+    if (d.triangles.empty()) return;
+
+    MeshGenData work = d;  // verts are never removed from this, so they keep matching the quadrics
+    vector<Quadric> quadrics;
+
+    float3 bmin = d.verts[0].pos, bmax = bmin;
+    for (auto &v : d.verts) { bmin = min(bmin, v.pos); bmax = max(bmax, v.pos); }
+    auto scenesize = length(bmax - bmin);
+    double totallen = 0;
+    for (size_t t = 0; t < d.triangles.size(); t += 3)
+        totallen += length(d.verts[d.triangles[t]].pos - d.verts[d.triangles[t + 1]].pos);
+    auto maxerror = max(polyreductionmaxerror, 0.01f) * float(totallen / (d.triangles.size() / 3));
+
+    // the normal epsilon and thin triangle limits of the reduction settings stall long before the coarse levels,
+    // and those are only seen from a distance
+    const float lodmindot = 0.5f, lodmaxcornerdot = 0.995f;
+
+    float worst = 0;
+    size_t prevtris = d.triangles.size();
+    for (int l = 1; l < levels; l++)
+    {
+        auto target = int(prevtris / 3 * ratio);
+        for (;;)
+        {
+            worst = max(worst, simplify_mesh(work.triangles, work.verts, quadrics, maxerror, target, lodmindot,
+                                             lodmaxcornerdot));
+            if ((int)work.triangles.size() / 3 <= target || maxerror > scenesize) break;
+            maxerror *= 2;
+        }
+        // a level that barely got simpler would cost more error than it's worth
+        if (work.triangles.size() / 3 > (prevtris / 3 + target) / 2) break;
+        prevtris = work.triangles.size();
+
+        lods.push_back(work);
+        auto &lod = lods.back();
+        remove_unused_verts(lod.triangles, lod.verts);
+        if (lod.triangles.size())
+            normalize_mesh(&lod.triangles[0], lod.triangles.size(), &lod.verts[0], lod.verts.size(), false);
+        errors.push_back(worst);
+    }
+}
+
+/////////// MESH CACHE
+
+// Procedural assets tend to be generated with the same mg_ commands every time, and polygonizing is by far the most
+// expensive step. So results are kept by the SHA-256 of everything that goes into them: in memory, dropping the least
+// recently used first, and optionally as <hash>.mgc files in a directory so they also load instantly on the next run.
+
+// Bump this whenever polygonize_mc produces different output, so files made by an older version are not used.
+const uint meshcacheversion = 1;
+
+size_t meshcachemaxbytes = 64 << 20;
+string meshcachedir;  // relative to the write dir, empty for no disk store
+
+typedef pair<string, MeshGenData> MeshCacheEntry;
+list<MeshCacheEntry> meshcache;  // most recently used first
+unordered_map<string, list<MeshCacheEntry>::iterator> meshcacheindex;
+size_t meshcachebytes = 0;
+int meshcachehits = 0, meshcachemisses = 0;  // since the last mg_cache_stats()
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint version, numverts, numindices;
+};
+
+string MeshCacheKey(ImplicitFunction *root, int subdiv, const vector<float3> &materials)
+{
+    SHA256 h;
+    HashValue(h, meshcacheversion);
+    root->Hash(h);
+    HashValue(h, subdiv);
+    HashValue(h, (int)materials.size());
+    for (auto &m : materials) HashValue(h, m);
+    // every setting that affects the mesh, polygonizethreads doesn't
+    HashValue(h, noisestretch);
+    HashValue(h, noiseintensity);
+    HashValue(h, randomizeverts);
+    HashValue(h, polyreductionpasses);
+    HashValue(h, epsilon);
+    HashValue(h, maxtricornerdot);
+    HashValue(h, polyreductionmaxerror);
+    HashValue(h, polyreductiontarget);
+    uchar digest[32];
+    h.Final(digest);
+    extern string HexDigest(const uchar *digest, int len);
+    return HexDigest(digest, 32);
+}
+
+string MeshCacheFileName(const string &key) { return meshcachedir + "/" + key + ".mgc"; }
+
+bool MeshCacheLoad(const string &key, MeshGenData &d)
+{
+    if (meshcachedir.empty()) return false;
+    size_t len = 0;
+    auto buf = LoadFile(MeshCacheFileName(key).c_str(), &len);
+    if (!buf) return false;
+    MeshCacheHeader h;
+    bool ok = len >= sizeof(h);
+    if (ok)
+    {
+        memcpy(&h, buf, sizeof(h));
+        ok = !memcmp(h.magic, "LMGC", 4) && h.version == meshcacheversion &&
+             len == sizeof(h) + (size_t)h.numverts * sizeof(mgvert) + (size_t)h.numindices * sizeof(int);
+    }
+    if (ok)
+    {
+        auto p = buf + sizeof(h);
+        d.verts.resize(h.numverts);
+        d.triangles.resize(h.numindices);
+        if (h.numverts) memcpy(&d.verts[0], p, h.numverts * sizeof(mgvert));
+        if (h.numindices) memcpy(&d.triangles[0], p + h.numverts * sizeof(mgvert), h.numindices * sizeof(int));
+        // a damaged file shouldn't be able to take down the renderer
+        for (auto i : d.triangles) if (i < 0 || i >= (int)h.numverts) ok = false;
+    }
+    free(buf);
+    return ok;
+}
+
+// The .mgc format: a MeshCacheHeader, then the verts as stored in memory (PNC, 28 bytes each), then the indices.
+bool WriteMGC(FILE *f, MeshGenData &d)
+{
+    MeshCacheHeader h = { { 'L', 'M', 'G', 'C' }, meshcacheversion, (uint)d.verts.size(), (uint)d.triangles.size() };
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (d.verts.size()) ok = ok && fwrite(&d.verts[0], sizeof(mgvert), d.verts.size(), f) == d.verts.size();
+    if (d.triangles.size()) ok = ok && fwrite(&d.triangles[0], sizeof(int), d.triangles.size(), f) == d.triangles.size();
+    return ok;
+}
+
+void MeshCacheSave(const string &key, MeshGenData &d)
+{
+    if (meshcachedir.empty()) return;
+    // no error if this fails (e.g. the directory doesn't exist), the cache is only an optimization
+    auto f = OpenForWriting(MeshCacheFileName(key).c_str(), true);
+    if (!f) return;
+    WriteMGC(f, d);
+    fclose(f);
+}
+
+void MeshCacheTrim()
+{
+    while (meshcachebytes > meshcachemaxbytes)
+    {
+        meshcachebytes -= meshcache.back().second.Bytes();
+        meshcacheindex.erase(meshcache.back().first);
+        meshcache.pop_back();
+    }
+}
+
+// Returns either the cache entry or d, which is only valid until the next call.
+MeshGenData &PolygonizeCached(ImplicitFunction *root, int subdiv, vector<float3> &materials, MeshGenData &d)
+{
+    if (!meshcachemaxbytes && meshcachedir.empty())
+    {
+        meshcachemisses++;
+        polygonize_mc(root, subdiv, materials, d);
+        return d;
+    }
+
+    auto key = MeshCacheKey(root, subdiv, materials);
+    auto it = meshcacheindex.find(key);
+    if (it != meshcacheindex.end())
+    {
+        meshcachehits++;
+        meshcache.splice(meshcache.begin(), meshcache, it->second);
+        return it->second->second;
+    }
+
+    if (MeshCacheLoad(key, d))
+    {
+        meshcachehits++;
+    }
+    else
+    {
+        meshcachemisses++;
+        polygonize_mc(root, subdiv, materials, d);
+        MeshCacheSave(key, d);
+    }
+
+    auto bytes = d.Bytes();
+    if (bytes > meshcachemaxbytes) return d;
+    meshcache.push_front(MeshCacheEntry(key, std::move(d)));
+    meshcacheindex[key] = meshcache.begin();
+    meshcachebytes += bytes;
+    MeshCacheTrim();
+    return meshcache.front().second;
+}
+
+/////////// EXPORT
+
+// Binary PLY, which keeps the normals and vertex colors exactly.
+bool WritePLY(FILE *f, MeshGenData &d)
+{
+    fprintf(f, "ply\nformat binary_little_endian 1.0\nelement vertex %lu\n"
+               "property float x\nproperty float y\nproperty float z\n"
+               "property float nx\nproperty float ny\nproperty float nz\n"
+               "property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\n"
+               "element face %lu\nproperty list uchar int vertex_indices\nend_header\n",
+               ulong(d.verts.size()), ulong(d.triangles.size() / 3));
+    bool ok = d.verts.empty() || fwrite(&d.verts[0], sizeof(mgvert), d.verts.size(), f) == d.verts.size();
+    vector<uchar> faces(d.triangles.size() / 3 * 13);
+    for (size_t t = 0; t < d.triangles.size() / 3; t++)
+    {
+        faces[t * 13] = 3;
+        memcpy(&faces[t * 13 + 1], &d.triangles[t * 3], 12);
+    }
+    return ok && (faces.empty() || fwrite(&faces[0], 1, faces.size(), f) == faces.size());
+}
+
+// Text OBJ for quick inspection, with the common "v x y z r g b" extension for vertex colors.
+bool WriteOBJ(FILE *f, MeshGenData &d)
+{
+    fprintf(f, "# lobster meshgen\n");
+    for (auto &v : d.verts)
+    {
+        auto c = color2vec(v.col);
+        fprintf(f, "v %g %g %g %g %g %g\n", v.pos.x(), v.pos.y(), v.pos.z(), c.x(), c.y(), c.z());
+    }
+    for (auto &v : d.verts) fprintf(f, "vn %g %g %g\n", v.norm.x(), v.norm.y(), v.norm.z());
+    for (size_t t = 0; t < d.triangles.size(); t += 3)
+    {
+        auto a = d.triangles[t] + 1, b = d.triangles[t + 1] + 1, c = d.triangles[t + 2] + 1;
+        fprintf(f, "f %d//%d %d//%d %d//%d\n", a, a, b, b, c, c);
+    }
+    return !ferror(f);
+}
+
+// Picks the format by extension: .ply, .obj, or otherwise .mgc (the same as the mesh cache files).
+bool ExportMesh(const char *filename, MeshGenData &d)
+{
+    auto ext = strrchr(filename, '.');
+    string e = ext ? ext : "";
+    for (auto &c : e) c = (char)tolower(c);
+    bool text = e == ".obj";
+    auto f = OpenForWriting(filename, !text);
+    if (!f) return false;
+    bool ok = e == ".ply" ? WritePLY(f, d) : text ? WriteOBJ(f, d) : WriteMGC(f, d);
+    return fclose(f) == 0 && ok;
+}
+
 
 Group *root = nullptr;
 Group *curgroup = nullptr;
@@ -932,6 +1913,29 @@ Value AddShape(ImplicitFunction *f)
     return Value();
 }
 
+// the packed binary strings mg_polygonize_data returns
+Value VertData(MeshGenData &d)
+{
+    return Value(g_vm->NewString((char *)d.verts.data(), (int)(d.verts.size() * sizeof(mgvert))));
+}
+
+Value IndexData(MeshGenData &d)
+{
+    return Value(g_vm->NewString((char *)d.triangles.data(), (int)(d.triangles.size() * sizeof(int))));
+}
+
+// Polygonizes (or takes from the cache) what the mg_ commands so far built, and starts a new scene. Doesn't touch
+// graphics, that is up to the caller.
+MeshGenData &PolygonizeScene(Value &subdiv, Value &color, MeshGenData &tmp)
+{
+    vector<float3> materials;
+    for (int i = 0; i < color.vval->len; i++) materials.push_back(ValueTo<float3>(color.vval->at(i)));
+    color.DECRT();
+    auto &d = PolygonizeCached(root, subdiv.ival, materials, tmp);
+    MeshGenClear();
+    return d;
+}
+
 void AddMeshGen()
 {
     STARTDECL(mg_sphere)   () { return AddShape(new IFSphere());   } ENDDECL0(mg_sphere,   "", "", "",
@@ -984,18 +1988,23 @@ void AddMeshGen()
         "a superquadric that allows you to specify exponents and sizes in all 6 directions independently for maximum"
         " modelling possibilities");
 
-    STARTDECL(mg_set_polygonreduction) (Value &polyreductionpasses, Value &epsilon, Value &maxtricornerdot)
+    STARTDECL(mg_set_polygonreduction) (Value &polyreductionpasses, Value &epsilon, Value &maxtricornerdot,
+                                        Value &maxerror, Value &targetratio)
     {
         ::polyreductionpasses = polyreductionpasses.ival;
         ::epsilon = epsilon.fval;
         ::maxtricornerdot = maxtricornerdot.fval;
+        ::polyreductionmaxerror = maxerror.fval > 0 ? maxerror.fval : 0.1f;
+        ::polyreductiontarget = targetratio.fval;
         return Value();
     }
-    ENDDECL3(mg_set_polygonreduction, "polyreductionpasses,epsilon,maxtricornerdot", "IFF", "",
-        "controls the polygon reduction algorithm. set polyreductionpasses to 0 for off, 100 for max compression,"
-        " or low values for generation speed or to keep the mesh uniform. epsilon determines how flat adjacent"
-        " triangles must be to be reduced, use 0.98 as a good tradeoff, lower to get more compression. maxtricornerdot"
-        " avoid very thin triangles, use 0.95 as a good tradeoff, up to 0.99 to get more compression");
+    ENDDECL5(mg_set_polygonreduction, "polyreductionpasses,epsilon,maxtricornerdot,maxerror,targetratio", "IFFff", "",
+        "controls the polygon reduction algorithm, which collapses edges in order of least error introduced."
+        " set polyreductionpasses to 0 for off, any other value for on. epsilon determines how much a collapse"
+        " may change the direction of the triangles around it, use 0.98 as a good tradeoff, lower to get more"
+        " compression. maxtricornerdot avoid very thin triangles, use 0.95 as a good tradeoff, up to 0.99 to get more"
+        " compression. maxerror is how far the surface may move, in grid cells (default 0.1). targetratio stops"
+        " once only that fraction of the triangles is left (default 0: reduce as far as maxerror allows)");
 
     STARTDECL(mg_set_colornoise) (Value &noiseintensity, Value &noisestretch)
     {
@@ -1017,19 +2026,127 @@ void AddMeshGen()
         " by the algorithm. try 0.15. note that any setting other than 0 will likely counteract the polygon"
         " reduction algorithm");
 
+    STARTDECL(mg_set_threads) (Value &n)
+    {
+        polygonizethreads = n.ival;
+        return Value();
+    }
+    ENDDECL1(mg_set_threads, "n", "I", "",
+        "sets how many threads mg_polygonize uses for sampling and marching cubes. the default of 0 uses all cores,"
+        " 1 turns threading off. the mesh comes out the same either way.");
+
+    STARTDECL(mg_set_cache) (Value &dir, Value &memorymb)
+    {
+        meshcachedir = dir.sval->str();
+        dir.DECRT();
+        meshcachemaxbytes = (size_t)max(memorymb.ival, 0) << 20;
+        MeshCacheTrim();
+        return Value();
+    }
+    ENDDECL2(mg_set_cache, "dir,memorymb", "SI", "",
+        "mg_polygonize keeps the meshes it makes by a hash of all mg_ commands and settings that went into them,"
+        " and returns a copy when asked for the same one again. memorymb limits the memory this uses (default 64,"
+        " 0 turns it off). if dir is not empty, meshes are also stored as files in that directory (relative to the"
+        " write directory, it must exist already), so they load instantly on the next run too");
+
+    STARTDECL(mg_cache_stats) ()
+    {
+        g_vm->Push(Value(meshcachehits));
+        auto misses = meshcachemisses;
+        meshcachehits = meshcachemisses = 0;
+        return Value(misses);
+    }
+    ENDDECL0(mg_cache_stats, "", "", "II",
+        "returns how many meshes since the last call came from the cache (see mg_set_cache), and how many had to be"
+        " generated");
+
     STARTDECL(mg_polygonize) (Value &subdiv, Value &color)
     {
-        vector<float3> materials;
-        for (int i = 0; i < color.vval->len; i++) materials.push_back(ValueTo<float3>(color.vval->at(i)));
-        color.DECRT();
-        int mesh = polygonize_mc(root, subdiv.ival, materials);
-        MeshGenClear();
-        return Value(mesh);
+        MeshGenData tmp;
+        return Value(MakeMesh(PolygonizeScene(subdiv, color, tmp)));
     }
     ENDDECL2(mg_polygonize, "subdiv,colors", "IV", "I", "returns a generated mesh (id 1..) from past mg_ commands."
         " subdiv determines detail and amount of polygons, try 30.. 300 depending on the subject."
         " values much higher than that will likely make you run out of memory (or take very long)."
-        " colors is a list of colors to be used with mg_fill()");
+        " colors is a list of colors to be used with mg_fill(). repeated calls for the same mesh come from a cache, see mg_set_cache()");
+
+    STARTDECL(mg_polygonize_lods) (Value &subdiv, Value &color, Value &levels, Value &ratio)
+    {
+        MeshGenData tmp;
+        auto &d = PolygonizeScene(subdiv, color, tmp);
+        vector<MeshGenData> lods;
+        vector<float> errors;
+        make_lods(d, levels.ival, ratio.fval, lods, errors);
+        auto mv = g_vm->NewVector((int)lods.size() + 1, V_VECTOR);
+        auto ev = g_vm->NewVector((int)lods.size() + 1, V_VECTOR);
+        mv->push(Value(MakeMesh(d)));
+        ev->push(Value(0.0f));
+        for (size_t i = 0; i < lods.size(); i++)
+        {
+            mv->push(Value(MakeMesh(lods[i])));
+            ev->push(Value(errors[i]));
+        }
+        g_vm->Push(Value(mv));
+        return Value(ev);
+    }
+    ENDDECL4(mg_polygonize_lods, "subdiv,colors,levels,ratio", "IVIF", "I]F]",
+        "like mg_polygonize, but returns a list of up to levels meshes, the first the same as what mg_polygonize"
+        " makes, and each next one simplified from it to about ratio (e.g. 0.5) times the triangles of the one before."
+        " this is much faster than polygonizing at lower subdivs. also returns for each mesh how far (RMS distance)"
+        " its surface may be from the first one. fewer meshes are returned if it can't be simplified much further");
+
+    STARTDECL(mg_polygonize_data) (Value &subdiv, Value &color)
+    {
+        MeshGenData tmp;
+        auto &d = PolygonizeScene(subdiv, color, tmp);
+        g_vm->Push(VertData(d));
+        return IndexData(d);
+    }
+    ENDDECL2(mg_polygonize_data, "subdiv,colors", "IV", "SS",
+        "like mg_polygonize, but instead of creating a mesh (which needs graphics) returns its data as two strings"
+        " of packed binary: the vertices (28 bytes each: position and normal as 3 floats, color as 4 bytes),"
+        " and the indices (an int each, 3 per triangle)");
+
+    STARTDECL(mg_polygonize_lods_data) (Value &subdiv, Value &color, Value &levels, Value &ratio)
+    {
+        MeshGenData tmp;
+        auto &d = PolygonizeScene(subdiv, color, tmp);
+        vector<MeshGenData> lods;
+        vector<float> errors;
+        make_lods(d, levels.ival, ratio.fval, lods, errors);
+        auto vv = g_vm->NewVector((int)lods.size() + 1, V_VECTOR);
+        auto iv = g_vm->NewVector((int)lods.size() + 1, V_VECTOR);
+        auto ev = g_vm->NewVector((int)lods.size() + 1, V_VECTOR);
+        vv->push(VertData(d));
+        iv->push(IndexData(d));
+        ev->push(Value(0.0f));
+        for (size_t i = 0; i < lods.size(); i++)
+        {
+            vv->push(VertData(lods[i]));
+            iv->push(IndexData(lods[i]));
+            ev->push(Value(errors[i]));
+        }
+        g_vm->Push(Value(vv));
+        g_vm->Push(Value(iv));
+        return Value(ev);
+    }
+    ENDDECL4(mg_polygonize_lods_data, "subdiv,colors,levels,ratio", "IVIF", "S]S]F]",
+        "like mg_polygonize_lods, but returns the data of each mesh in the same format as mg_polygonize_data"
+        " (vertices and indices), followed by the errors");
+
+    STARTDECL(mg_polygonize_to_file) (Value &subdiv, Value &color, Value &filename)
+    {
+        MeshGenData tmp;
+        auto &d = PolygonizeScene(subdiv, color, tmp);
+        bool ok = ExportMesh(filename.sval->str(), d);
+        filename.DECRT();
+        return Value(ok);
+    }
+    ENDDECL3(mg_polygonize_to_file, "subdiv,colors,filename", "IVS", "I",
+        "like mg_polygonize, but instead of creating a mesh (which needs graphics) writes it to a file in the write"
+        " directory. a .ply or .obj extension writes that format, anything else a compact binary file: a 16 byte"
+        " header (\"LMGC\", version, vertex count, index count as ints) followed by the same data"
+        " mg_polygonize_data returns. returns false if the file couldn't be written");
 
     STARTDECL(mg_translate) (Value &vec, Value &body)
     {
@@ -150,8 +150,11 @@ extern TypeRef type_vector_int;
 extern TypeRef type_vector_float;
 extern TypeRef type_function_null;
 extern TypeRef type_coroutine;
+extern TypeRef type_hashmap;
+extern TypeRef type_prioqueue;
+extern TypeRef type_strbuilder;
 
-enum ArgFlags { AF_NONE, NF_EXPFUNVAL, NF_OPTIONAL, AF_ANYTYPE, NF_SUBARG1, NF_ANYVAR };
+enum ArgFlags { AF_NONE, NF_EXPFUNVAL, NF_OPTIONAL, AF_ANYTYPE, NF_SUBARG1, NF_ANYVAR, NF_STRVIEW };
 
 template<typename T> struct Typed
 {
@@ -184,6 +187,9 @@ template<typename T> struct Typed
             case 'V': type = type_vector_any; break;  // Deprecated, use ']'
             case 'C': type = type_function_null; break;
             case 'R': type = type_coroutine; break;
+            case 'H': type = type_hashmap; break;
+            case 'Q': type = type_prioqueue; break;
+            case 'B': type = type_strbuilder; break;
             case 'A': type = type_any; break;
             default:  assert(0);
         }
@@ -195,6 +201,7 @@ template<typename T> struct Typed
                 case '1': flags = NF_SUBARG1; break;
                 case '*': flags = NF_ANYVAR; break;
                 case '@': flags = NF_EXPFUNVAL; break;
+                case '&': flags = NF_STRVIEW; break;  // string may be a view, i.e. is not zero terminated
                 case ']': typestorage.push_back(Type()); type = type->Wrap(&typestorage.back()); break;
                 case '?': typestorage.push_back(Type()); type = type->Wrap(&typestorage.back(), V_NILABLE); break;
                 case ':': assert(*tid >= '/' && *tid <= '9'); fixed_len = *tid++ - '0'; break;
@@ -31,13 +31,12 @@ struct Parser
         : lex(_src, _st.filenames, _stringsource), root(nullptr), st(_st)
     {
         assert(parserpool == nullptr);
-        parserpool = new SlabAlloc();
+        parserpool = new Arena();
     }
     
     ~Parser()
     {
-        delete root;
-
+        // no need to delete root: all nodes (and types, strings) go away with the arena in one go.
         delete parserpool;
         parserpool = nullptr;
     }
@@ -234,7 +233,7 @@ struct Parser
             {
                 bool isvalue = lex.token == T_VALUE;
                 lex.Next();
-                auto sname = lex.sattr;
+                string sname = lex.sattr;
                 Expect(T_IDENT);
 
                 Struct &struc = st.StructDecl(sname, lex);
@@ -244,7 +243,7 @@ struct Parser
                 if (IsNext(T_ASSIGN))
                 {
                     // A specialization of an existing struct
-                    auto gname = lex.sattr;
+                    string gname = lex.sattr;
                     Expect(T_IDENT);
                     auto &gstruc = st.StructUse(gname, lex);
 
@@ -354,14 +353,14 @@ struct Parser
                 int cur = incremental ? 0 : 1;
                 for (;;)
                 {
-                    auto idname = lex.sattr;
+                    string idname = lex.sattr;
                     Expect(T_IDENT);
                     auto id = st.LookupDef(idname, lex.errorline, lex, false, true);
                     id->constant = true;
                     if (isprivate) id->isprivate = true;
                     if (IsNext(T_ASSIGN))
                     {
-                        cur = atoi(lex.sattr.c_str());
+                        cur = lex.ival;
                         Expect(T_INT);
                     }
                     AddTail(tail, (Node *)new Ternary(lex, T_DEF, new IdRef(lex, id), new IntConst(lex, cur), nullptr));
@@ -612,12 +611,13 @@ struct Parser
             case T_FLOATTYPE: dest = type_float;      lex.Next(); break;
             case T_STRTYPE:   dest = type_string;     lex.Next(); break;
             case T_COROUTINE: dest = type_coroutine;  lex.Next(); break;
+            case T_HASHMAPTYPE: dest = type_hashmap;  lex.Next(); break;
             case T_VECTTYPE:  dest = type_vector_any; lex.Next(); break;  // FIXME: remove this one?
 
             case T_FUN:
             {
                 lex.Next();
-                auto idname = lex.sattr;
+                string idname = lex.sattr;
                 if (IsNext(T_IDENT))
                 {
                     auto f = st.FindFunction(idname);
@@ -643,7 +643,7 @@ struct Parser
                         if (field.id->name == lex.sattr)
                         {
                             if (field.flags != AF_ANYTYPE)
-                                Error("field reference must be to generic field: " + lex.sattr);
+                                Error("field reference must be to generic field: " + lex.sattr.str());
                             lex.Next();
                             dest = field.type;
                             return &field - &fieldrefstruct->fields[0];
@@ -1155,9 +1155,9 @@ struct Parser
     {
         switch (lex.token)
         {
-            case T_INT:   { int i    = atoi(lex.sattr.c_str()); lex.Next(); return (Node *)new IntConst(lex, i); }
-            case T_FLOAT: { double f = atof(lex.sattr.c_str()); lex.Next(); return (Node *)new FltConst(lex, f); }
-            case T_STR:   { string s = lex.sattr;               lex.Next(); return (Node *)new StrConst(lex, s); }
+            case T_INT:   { int i    = lex.ival;  lex.Next(); return (Node *)new IntConst(lex, i); }
+            case T_FLOAT: { double f = lex.fval;  lex.Next(); return (Node *)new FltConst(lex, f); }
+            case T_STR:   { string s = lex.sattr; lex.Next(); return (Node *)new StrConst(lex, s); }
 
             case T_NIL:
             {
@@ -17,6 +17,11 @@
 #include "stdafx.h"
 #include <stdarg.h>
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
 #ifdef WIN32
     #define VC_EXTRALEAN
     #define WIN32_LEAN_AND_MEAN
@@ -177,7 +182,7 @@ uchar *LoadFilePlatform(const char *absfilename, size_t *lenret)
     #endif
 }
 
-uchar *LoadFile(const char *relfilename, size_t *lenret)
+uchar *LoadFileDirect(const char *relfilename, size_t *lenret)
 {
     auto srfn = SanitizePath(relfilename);
     auto f = LoadFilePlatform((datadir + srfn).c_str(), lenret);
@@ -187,11 +192,162 @@ uchar *LoadFile(const char *relfilename, size_t *lenret)
     return LoadFilePlatform((writedir + srfn).c_str(), lenret);
 }
 
-FILE *OpenForWriting(const char *relfilename, bool binary)
+// Runs load jobs on a few worker threads. Results wait (by key) until the main thread takes them, so nothing the
+// workers do touches the VM or GL.
+class AsyncLoader
+{
+    struct Job
+    {
+        string key;
+        function<uchar *(size_t &len)> load;
+    };
+
+    struct Result
+    {
+        uchar *buf;
+        size_t len;
+        bool done;
+    };
+
+    vector<thread> workers;
+    list<Job> jobs;
+    map<string, Result> results;    // all started jobs, until taken
+    mutex mtx;
+    condition_variable jobadded, jobdone;
+    bool quit;
+
+    void Worker()
+    {
+        unique_lock<mutex> lock(mtx);
+        for (;;)
+        {
+            jobadded.wait(lock, [&]() { return quit || !jobs.empty(); });
+            if (quit) return;
+            auto job = jobs.front();
+            jobs.pop_front();
+            lock.unlock();
+            size_t len = 0;
+            auto buf = job.load(len);
+            lock.lock();
+            auto &r = results[job.key];
+            r.buf = buf;
+            r.len = len;
+            r.done = true;
+            jobdone.notify_all();
+        }
+    }
+
+    public:
+
+    AsyncLoader() : quit(false) {}
+
+    ~AsyncLoader()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            quit = true;
+            jobs.clear();
+        }
+        jobadded.notify_all();
+        for (auto &t : workers) t.join();
+        for (auto &r : results) free(r.second.buf);
+    }
+
+    void Start(const string &key, const function<uchar *(size_t &len)> &load)
+    {
+        lock_guard<mutex> lock(mtx);
+        if (results.find(key) != results.end()) return;
+        Result r = { nullptr, 0, false };
+        results[key] = r;
+        Job job = { key, load };
+        jobs.push_back(job);
+        if (workers.empty())
+        {
+            // leave a core for the main thread, more than a few threads just fight over the disk
+            auto n = max(1, min(4, (int)thread::hardware_concurrency() - 1));
+            for (int i = 0; i < n; i++) workers.push_back(thread([this]() { Worker(); }));
+        }
+        jobadded.notify_one();
+    }
+
+    bool Done(const string &key)
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = results.find(key);
+        return it == results.end() || it->second.done;
+    }
+
+    bool Take(const string &key, uchar *&buf, size_t &len)
+    {
+        unique_lock<mutex> lock(mtx);
+        auto it = results.find(key);
+        if (it == results.end()) return false;
+        jobdone.wait(lock, [&]() { return it->second.done; });
+        buf = it->second.buf;
+        len = it->second.len;
+        results.erase(it);
+        return true;
+    }
+};
+
+AsyncLoader asyncloader;
+
+void StartAsync(const string &key, const function<uchar *(size_t &len)> &load) { asyncloader.Start(key, load); }
+bool AsyncDone(const string &key) { return asyncloader.Done(key); }
+bool TakeAsync(const string &key, uchar *&buf, size_t &len) { return asyncloader.Take(key, buf, len); }
+
+void LoadFileAsync(const char *relfilename)
+{
+    auto srfn = SanitizePath(relfilename);
+    StartAsync(srfn, [srfn](size_t &len) { return LoadFileDirect(srfn.c_str(), &len); });
+}
+
+bool FileLoadedAsync(const char *relfilename) { return AsyncDone(SanitizePath(relfilename)); }
+
+void ParallelFor(int n, int nthreads, const function<void(int)> &body)
+{
+    atomic<int> next(0);
+    auto work = [&]() { for (int i; (i = next++) < n; ) body(i); };
+    vector<thread> helpers;
+    if (nthreads <= 0) nthreads = thread::hardware_concurrency();
+    auto nhelpers = min(n, nthreads) - 1;
+    for (int i = 0; i < nhelpers; i++) helpers.push_back(thread(work));
+    work();
+    for (auto &t : helpers) t.join();
+}
+
+uchar *LoadFile(const char *relfilename, size_t *lenret)
+{
+    uchar *buf;
+    size_t len;
+    if (TakeAsync(SanitizePath(relfilename), buf, len))
+    {
+        if (lenret) *lenret = len;
+        return buf;
+    }
+    return LoadFileDirect(relfilename, lenret);
+}
+
+string FindFile(const char *relfilename)
 {
-    return fopen((writedir + SanitizePath(relfilename)).c_str(), binary ? "wb" : "w");
+    // same search order as LoadFile()
+    auto srfn = SanitizePath(relfilename);
+    for (auto dir : { &datadir, &auxdir, &writedir })
+    {
+        auto fn = *dir + srfn;
+        auto f = fopen(fn.c_str(), "rb");
+        if (f) { fclose(f); return fn; }
+    }
+    return "";
 }
 
+FILE *OpenForWriting(const char *relfilename, bool binary, bool append)
+{
+    return fopen((writedir + SanitizePath(relfilename)).c_str(), append ? (binary ? "ab" : "a") : (binary ? "wb" : "w"));
+}
+
+string WriteDir() { return writedir; }
+
 OutputType min_output_level = OUTPUT_WARN;
 
 void Output(OutputType ot, const char *msg, ...)
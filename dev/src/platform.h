@@ -21,9 +21,33 @@ extern string StripDirPart(const char *filepath);
 extern bool SetupDefaultDirs(const char *exefilepath, const char *auxfilepath, bool from_bundle);
 
 extern uchar *LoadFile(const char *relfilename, size_t *len = nullptr);
-extern FILE *OpenForWriting(const char *relfilename, bool binary);
+// like LoadFile(), but never uses the result of LoadFileAsync(), which is what the worker threads use
+extern uchar *LoadFileDirect(const char *relfilename, size_t *len = nullptr);
+// returns the full path LoadFile() would load relfilename from, or "" if it doesn't exist
+extern string FindFile(const char *relfilename);
+extern FILE *OpenForWriting(const char *relfilename, bool binary, bool append = false);
+// the folder OpenForWriting() writes to, either empty or ending in a separator
+extern string WriteDir();
 extern string SanitizePath(const char *path);
 
+// background loading:
+
+// Runs load on a worker thread, unless a job with the same key was already started and not taken yet.
+// load returns a malloc-ed buffer (or nullptr), so it must not touch the VM, GL etc.
+extern void StartAsync(const string &key, const function<uchar *(size_t &len)> &load);
+// true once the job for key has finished, or if there is none
+extern bool AsyncDone(const string &key);
+// hands over the result of the job for key, waiting for it to finish if needed. false if there is no such job.
+extern bool TakeAsync(const string &key, uchar *&buf, size_t &len);
+
+// Starts loading a file in the background. The next LoadFile() of it takes the result from memory instead.
+extern void LoadFileAsync(const char *relfilename);
+extern bool FileLoadedAsync(const char *relfilename);
+
+// Calls body(0) .. body(n - 1) spread over nthreads threads (including the calling one, <= 0 means one per core),
+// returns when all are done. body must not throw.
+extern void ParallelFor(int n, int nthreads, const function<void(int)> &body);
+
 // logging:
 
 enum OutputType
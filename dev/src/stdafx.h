@@ -34,6 +34,7 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <list>
 #include <set>
@@ -326,6 +326,45 @@ inline char *flttoa(double f, int decimals = -1)
     return _buf; 
 }
 
+// Appending versions of the above, for building up larger strings in one buffer without temporaries.
+inline void appendint(string &sd, int i)
+{
+    char buf[16];
+    auto end = buf + sizeof(buf);
+    auto p = end;
+    auto u = i < 0 ? 0u - (uint)i : (uint)i;
+    do { *--p = '0' + u % 10; u /= 10; } while (u);
+    if (i < 0) *--p = '-';
+    sd.append(p, end - p);
+}
+
+inline void appendflt(string &sd, double f, int decimals = -1)
+{
+    if (decimals < 0) decimals = 6;  // what %f does
+    // Any float of modest size times a small power of 10 is exact in a double, so rounding that to an integer
+    // gives the same digits printf would produce. Everything else (doubles, huge values, inf/nan) uses printf.
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    if (decimals > 9 || (double)(float)f != f || fabs(f) >= 1e9)
+    {
+        char buf[512];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, f);
+        sd += buf;
+        return;
+    }
+    auto scale = (long long)pow10[decimals];
+    auto scaled = (long long)nearbyint(fabs(f) * pow10[decimals]);
+    if (signbit(f)) sd += '-';
+    char buf[32];
+    auto end = buf + sizeof(buf);
+    auto p = end;
+    auto frac = scaled % scale;
+    for (int i = 0; i < decimals; i++) { *--p = '0' + frac % 10; frac /= 10; }
+    if (decimals) *--p = '.';
+    auto ipart = scaled / scale;
+    do { *--p = '0' + ipart % 10; ipart /= 10; } while (ipart);
+    sd.append(p, end - p);
+}
+
 /* Accumulator: a container that is great for accumulating data like std::vector,
    but without the reallocation/copying and unused memory overhead.
    Instead stores elements as a 2-way growing list of blocks.
@@ -471,6 +510,115 @@ template <typename T> struct DS
     }
 };
 
+// Binary min-heap of int ids with a float priority, ties broken by a second float and then by insertion order.
+// Ids are small non-negative ints chosen by the caller (e.g. an index into an array of nodes): the position of each id
+// in the heap is tracked in a direct lookup table, which makes changing the priority of a queued id O(log n).
+
+class PrioQueue
+{
+    struct Entry
+    {
+        float prio, tie;
+        int seq;
+        int id;
+
+        bool operator<(const Entry &o) const
+        {
+            return prio != o.prio ? prio < o.prio : (tie != o.tie ? tie < o.tie : seq < o.seq);
+        }
+    };
+
+    vector<Entry> heap;
+    vector<int> pos;    // id -> index in heap, -1 if not queued
+    int seq;
+
+    void Place(const Entry &e, size_t i)
+    {
+        heap[i] = e;
+        pos[e.id] = (int)i;
+    }
+
+    void SiftUp(size_t i)
+    {
+        auto e = heap[i];
+        while (i)
+        {
+            auto parent = (i - 1) / 2;
+            if (!(e < heap[parent])) break;
+            Place(heap[parent], i);
+            i = parent;
+        }
+        Place(e, i);
+    }
+
+    void SiftDown(size_t i)
+    {
+        auto e = heap[i];
+        for (;;)
+        {
+            auto child = i * 2 + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && heap[child + 1] < heap[child]) child++;
+            if (!(heap[child] < e)) break;
+            Place(heap[child], i);
+            i = child;
+        }
+        Place(e, i);
+    }
+
+    public:
+
+    PrioQueue() : seq(0) {}
+
+    size_t Size() const { return heap.size(); }
+
+    bool Contains(int id) const { return id >= 0 && id < (int)pos.size() && pos[id] >= 0; }
+
+    // Adds id, or if it is already queued, changes its priority (keeping its place among equal priorities).
+    void Push(int id, float prio, float tie = 0)
+    {
+        assert(id >= 0);
+        if (Contains(id))
+        {
+            auto i = (size_t)pos[id];
+            auto &e = heap[i];
+            auto up = prio < e.prio || (prio == e.prio && tie < e.tie);
+            e.prio = prio;
+            e.tie = tie;
+            if (up) SiftUp(i); else SiftDown(i);
+            return;
+        }
+        if (id >= (int)pos.size()) pos.resize(max(id + 1, (int)pos.size() * 2), -1);
+        Entry e = { prio, tie, seq++, id };
+        heap.push_back(e);
+        SiftUp(heap.size() - 1);
+    }
+
+    int Top() const { assert(Size()); return heap[0].id; }
+    float TopPrio() const { assert(Size()); return heap[0].prio; }
+
+    int Pop()
+    {
+        assert(Size());
+        auto id = heap[0].id;
+        pos[id] = -1;
+        auto last = heap.back();
+        heap.pop_back();
+        if (heap.size())
+        {
+            Place(last, 0);
+            SiftDown(0);
+        }
+        return id;
+    }
+
+    void Clear()
+    {
+        for (auto &e : heap) pos[e.id] = -1;
+        heap.clear();
+    }
+};
+
 // Container that turns pointers into integers, with O(1) add/delete/get.
 // Robust: passing invalid integers will just return a nullptr pointer / ignore the delete
 // Cannot store nullptr pointers (will assert on Add)
@@ -619,6 +767,215 @@ template <typename T> class IntResourceManagerCompact
 };
 
 
+// Streaming hashes: construct, Update() with as many chunks as you like, then Final().
+// All read input bytes with memcpy, so work on unaligned data, and assume a little-endian machine.
+
+inline uint rotl32(uint x, int r) { return (x << r) | (x >> (32 - r)); }
+
+// xxHash32 (https://github.com/Cyan4973/xxHash): fast non-cryptographic hash, 4 independent lanes per 16 bytes.
+class XXHash32
+{
+    enum : uint { P1 = 2654435761U, P2 = 2246822519U, P3 = 3266489917U, P4 = 668265263U, P5 = 374761393U };
+
+    uint v[4], seed, total;
+    uchar mem[16];
+    size_t memsize;
+    bool large;  // total wraps at 4GB, so remember if we've seen 16 bytes or more
+
+    static uint Round(uint acc, uint input) { return rotl32(acc + input * P2, 13) * P1; }
+    static uint Read32(const uchar *p) { uint u; memcpy(&u, p, 4); return u; }
+
+    void Stripe(const uchar *p)
+    {
+        for (int i = 0; i < 4; i++) v[i] = Round(v[i], Read32(p + i * 4));
+    }
+
+    public:
+
+    XXHash32(uint _seed = 0) : seed(_seed), total(0), memsize(0), large(false)
+    {
+        v[0] = seed + P1 + P2;
+        v[1] = seed + P2;
+        v[2] = seed;
+        v[3] = seed - P1;
+    }
+
+    void Update(const void *data, size_t len)
+    {
+        auto p = (const uchar *)data;
+        auto end = p + len;
+        total += (uint)len;
+        if (memsize + len < 16)
+        {
+            memcpy(mem + memsize, p, len);
+            memsize += len;
+            return;
+        }
+        large = true;
+        if (memsize)
+        {
+            auto fill = 16 - memsize;
+            memcpy(mem + memsize, p, fill);
+            Stripe(mem);
+            p += fill;
+            memsize = 0;
+        }
+        for (; p + 16 <= end; p += 16) Stripe(p);
+        memsize = end - p;
+        memcpy(mem, p, memsize);
+    }
+
+    uint Final() const
+    {
+        uint h = large
+            ? rotl32(v[0], 1) + rotl32(v[1], 7) + rotl32(v[2], 12) + rotl32(v[3], 18)
+            : seed + P5;
+        h += total;
+        auto p = mem, end = mem + memsize;
+        for (; p + 4 <= end; p += 4) h = rotl32(h + Read32(p) * P3, 17) * P4;
+        for (; p < end; p++) h = rotl32(h + *p * P5, 11) * P1;
+        h ^= h >> 15;
+        h *= P2;
+        h ^= h >> 13;
+        h *= P3;
+        h ^= h >> 16;
+        return h;
+    }
+};
+
+// CRC-32 as used by zip/png/ethernet (reflected polynomial 0xEDB88320), slicing by 8 bytes at a time.
+class CRC32
+{
+    uint crc;
+
+    static const uint (&Tables())[8][256]
+    {
+        static uint t[8][256];
+        static bool init = [&]()
+        {
+            for (uint i = 0; i < 256; i++)
+            {
+                uint c = i;
+                for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+                t[0][i] = c;
+            }
+            for (uint i = 0; i < 256; i++)
+                for (int s = 1; s < 8; s++) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+            return true;
+        }();
+        (void)init;
+        return t;
+    }
+
+    public:
+
+    CRC32() : crc(0xFFFFFFFF) {}
+
+    void Update(const void *data, size_t len)
+    {
+        auto &t = Tables();
+        auto p = (const uchar *)data;
+        auto c = crc;
+        for (; len >= 8; len -= 8, p += 8)
+        {
+            uint a, b;
+            memcpy(&a, p, 4);
+            memcpy(&b, p + 4, 4);
+            a ^= c;
+            c = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+                t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+        }
+        while (len--) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+        crc = c;
+    }
+
+    uint Final() const { return ~crc; }
+};
+
+// SHA-256 (FIPS 180-4).
+class SHA256
+{
+    uint h[8];
+    uchar block[64];
+    size_t blocksize;
+    uint64_t total;
+
+    void Compress(const uchar *p)
+    {
+        static const uint k[64] =
+        {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        auto rotr = [](uint x, int r) { return (x >> r) | (x << (32 - r)); };
+        uint w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint)p[i * 4] << 24 | (uint)p[i * 4 + 1] << 16 | (uint)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+        for (int i = 16; i < 64; i++)
+        {
+            auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++)
+        {
+            auto t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    public:
+
+    SHA256() : blocksize(0), total(0)
+    {
+        static const uint init[8] =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(h, init, sizeof(h));
+    }
+
+    void Update(const void *data, size_t len)
+    {
+        auto p = (const uchar *)data;
+        total += len;
+        if (blocksize)
+        {
+            auto fill = min(64 - blocksize, len);
+            memcpy(block + blocksize, p, fill);
+            blocksize += fill;
+            p += fill;
+            len -= fill;
+            if (blocksize < 64) return;
+            Compress(block);
+            blocksize = 0;
+        }
+        for (; len >= 64; len -= 64, p += 64) Compress(p);
+        memcpy(block, p, len);
+        blocksize = len;
+    }
+
+    // Writes the 32 byte digest. Leaves this object in an undefined state.
+    void Final(uchar *digest)
+    {
+        auto bits = total * 8;
+        uchar pad[72] = { 0x80 };
+        auto padlen = (blocksize < 56 ? 56 : 120) - blocksize;
+        for (int i = 0; i < 8; i++) pad[padlen + i] = (uchar)(bits >> (56 - i * 8));
+        Update(pad, padlen + 8);
+        for (int i = 0; i < 32; i++) digest[i] = (uchar)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+};
+
 /*
 
 // from: http://average-coder.blogspot.com/2012/07/python-style-range-loops-in-c.html
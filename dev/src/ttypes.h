@@ -112,6 +112,7 @@ namespace lobster
     T(T_FLOATTYPE, "float", TT_NONE, NO, a, NO, b) \
     T(T_STRTYPE, "string", TT_NONE, NO, a, NO, b) \
     T(T_VECTTYPE, "vector", TT_NONE, NO, a, NO, b) \
+    T(T_HASHMAPTYPE, "hashmap", TT_NONE, NO, a, NO, b) \
     T(T_FROM, "from", TT_NONE, NO, a, NO, b) \
     T(T_PROGRAM, "program", TT_NONE, NO, a, NO, b) \
     T(T_PRIVATE, "private", TT_NONE, NO, a, NO, b) \
@@ -20,7 +20,39 @@ struct TypeChecker
     };
     vector<FlowItem> flowstack;
 
-    TypeChecker(Parser &_p, SymbolTable &_st) : lex(_p.lex), parser(_p), st(_st)
+    // All typechecked specializations of generic functions, indexed by the types they were specialized to:
+    // the types of their untyped args followed by those of their freevars.
+    struct SpecKey
+    {
+        Function *f;
+        vector<TypeRef> types;
+
+        bool operator==(const SpecKey &o) const { return f == o.f && types == o.types; }
+    };
+
+    struct SpecKeyHash
+    {
+        static size_t HashType(const Type *t)
+        {
+            // Must be consistent with Type::operator==, which compares wrapped types by value.
+            return t->Wrapped() ? t->t * 31 + HashType(t->sub) : t->t * 31 + (size_t)t->sub;
+        }
+
+        size_t operator()(const SpecKey &k) const
+        {
+            size_t h = (size_t)k.f;
+            for (auto &type : k.types) h = h * 31 + HashType(&*type);
+            return h;
+        }
+    };
+
+    unordered_map<SpecKey, SubFunction *, SpecKeyHash> specializations;
+    // Specializations whose types contain type variables. UnifyVar overwrites those in place, which would change
+    // the hash of a key after it was added, so these are found by scanning instead.
+    unordered_map<Function *, vector<SubFunction *>> varspecializations;
+    int spec_hits, spec_misses;
+
+    TypeChecker(Parser &_p, SymbolTable &_st) : lex(_p.lex), parser(_p), st(_st), spec_hits(0), spec_misses(0)
     {
         st.RegisterDefaultVectorTypes();
         for (auto &struc : st.structtable)
@@ -401,6 +433,7 @@ struct TypeChecker
         if (!sf.parent->anonymous) named_scopes.push_back(scope);
 
         sf.typechecked = true;
+        AddSpecialization(sf);
 
         auto backup_args = sf.args;
         auto backup_locals = sf.locals;
@@ -596,6 +629,93 @@ struct TypeChecker
         return true;
     }
     
+    SpecKey SpecializationKey(SubFunction &sf)
+    {
+        SpecKey key;
+        key.f = sf.parent;
+        for (auto &arg : sf.args.v) if (arg.flags == AF_ANYTYPE) key.types.push_back(arg.type);
+        for (auto &freevar : sf.freevars.v) key.types.push_back(freevar.type);
+        return key;
+    }
+
+    bool HasTypeVar(const SpecKey &key)
+    {
+        for (auto &type : key.types)
+        {
+            for (auto t = &*type; ; t = t->sub)
+            {
+                if (t->t == V_VAR) return true;
+                if (!t->Wrapped()) break;
+            }
+        }
+        return false;
+    }
+
+    void AddSpecialization(SubFunction &sf)
+    {
+        if (sf.parent->multimethod || sf.parent->istype) return;
+        auto key = SpecializationKey(sf);
+        if (HasTypeVar(key))
+        {
+            auto &vs = varspecializations[sf.parent];
+            if (find(vs.begin(), vs.end(), &sf) == vs.end()) vs.push_back(&sf);
+            return;
+        }
+        auto it = specializations.find(key);
+        // Keep the oldest match, unless that one has since been re-specialized to different types.
+        if (it == specializations.end() || !(SpecializationKey(*it->second) == key)) specializations[key] = &sf;
+    }
+
+    SubFunction *FindSpecialization(Function &f, Node *call_args)
+    {
+        SpecKey key;
+        key.f = &f;
+        int i = 0;
+        for (Node *list = call_args; list && i < f.nargs(); list = list->tail())
+        {
+            auto &arg = f.subf->args.v[i++];
+            if (arg.flags == AF_ANYTYPE) key.types.push_back(list->head()->exptype);
+        }
+        if (i < f.nargs())
+        {
+            // Too few args to form a key (an error will follow), fall back to matching just the ones we have.
+            for (auto sf = f.subf; sf; sf = sf->next) if (sf->typechecked)
+            {
+                int j = 0;
+                for (Node *list = call_args; list && j < f.nargs(); list = list->tail())
+                {
+                    auto &arg = sf->args.v[j++];
+                    if (arg.flags == AF_ANYTYPE && !ExactType(list->head()->exptype, arg.type)) goto fail;
+                }
+                if (FreeVarsSameAsCurrent(sf)) return sf;
+                fail:;
+            }
+            return nullptr;
+        }
+        for (auto &freevar : f.subf->freevars.v) key.types.push_back(freevar.id->type);
+        if (!HasTypeVar(key))
+        {
+            auto it = specializations.find(key);
+            if (it != specializations.end() && it->second->typechecked && SpecializationKey(*it->second) == key)
+            {
+                spec_hits++;
+                return it->second;
+            }
+        }
+        // Those with type variables may match either way, e.g. [] specialized before any elements were pushed.
+        auto vit = varspecializations.find(&f);
+        if (vit != varspecializations.end()) for (auto sf : vit->second)
+        {
+            if (sf->typechecked && SpecializationKey(*sf) == key)
+            {
+                spec_hits++;
+                return sf;
+            }
+        }
+        spec_misses++;
+        return nullptr;
+    }
+
     SubFunction *CloneFunction(SubFunction *csf)
     {
         Output(OUTPUT_DEBUG, "cloning: %s", csf->parent->name.c_str());
@@ -635,17 +755,8 @@ struct TypeChecker
                 if (sf->typechecked)
                 {
                     // Check if any existing specializations match.
-                    for (sf = f.subf; sf; sf = sf->next) if (sf->typechecked)
-                    {
-                        int i = 0;
-                        for (Node *list = call_args; list && i < f.nargs(); list = list->tail())
-                        {
-                            auto &arg = sf->args.v[i++];
-                            if (arg.flags == AF_ANYTYPE && !ExactType(list->head()->exptype, arg.type)) goto fail;
-                        }
-                        if (FreeVarsSameAsCurrent(sf)) goto match;
-                        fail:;
-                    }
+                    sf = FindSpecialization(f, call_args);
+                    if (sf) goto match;
                     // No fit. Specialize existing function, or its clone.
                     sf = CloneFunction(csf);
                 }
@@ -733,6 +844,8 @@ struct TypeChecker
         {
             freevar.type = freevar.id->type;  // Specialized to current value.
         }
+        // If this was already typechecked (as a function value), its index entry is now out of date.
+        if (sf->typechecked) AddSpecialization(*sf);
 
         // Output without types, since those are yet to be overwritten.
         Output(OUTPUT_DEBUG, "pre-specialization: %s", SignatureWithFreeVars(*sf, false).c_str());
@@ -1571,14 +1684,31 @@ struct TypeChecker
     {
         int origsf = 0, multisf = 0, clonesf = 0;
         int orignodes = 0, clonenodes = 0;
+        struct FunStats { Function *f; int numsf, nodes; };
+        map<Function *, FunStats> funstats;
         for (auto sf : st.subfunctiontable)
         {
-            if (sf->parent->multimethod) { multisf++; orignodes += sf->body->Count(); }
-            else if (!sf->next)          { origsf++;  orignodes += sf->body->Count(); }
-            else                         { clonesf++; clonenodes += sf->body->Count(); }
+            // Count() checks for a null this, which the optimizer may drop, and some subfunctions have no body.
+            int count = sf->body ? sf->body->Count() : 0;
+            if (sf->parent->multimethod) { multisf++; orignodes += count; continue; }
+            else if (!sf->next)          { origsf++;  orignodes += count; }
+            else                         { clonesf++; clonenodes += count; }
+            auto &fs = funstats[sf->parent];
+            fs.f = sf->parent;
+            fs.numsf++;
+            fs.nodes += count;
         }
         Output(OUTPUT_DEBUG, "SF count: multi: %d, orig: %d, cloned: %d", multisf, origsf, clonesf);
         Output(OUTPUT_DEBUG, "Node count: orig: %d, cloned: %d", orignodes, clonenodes);
+        Output(OUTPUT_DEBUG, "specialization cache: %d hits, %d misses", spec_hits, spec_misses);
+
+        // Report which generic functions got specialized the most, by the amount of code this resulted in.
+        vector<FunStats> worst;
+        for (auto &p : funstats) if (p.second.numsf > 1) worst.push_back(p.second);
+        sort(worst.begin(), worst.end(), [](const FunStats &a, const FunStats &b) { return a.nodes > b.nodes; });
+        if (worst.size() > 10) worst.resize(10);
+        for (auto &fs : worst)
+            Output(OUTPUT_INFO, "specialized: %s: %d copies, %d nodes total", fs.f->name.c_str(), fs.numsf, fs.nodes);
     }
 };
 
@@ -171,6 +171,7 @@ struct VM : VMBase
                             break;
                                     
                         case V_STRING:
+                        case V_STRVIEW:
                         {
                             auto str = (LString *)vec;
                             fputs((str->CycleStr() + " = " + str->ToString(leakpp) + "\n").c_str(), leakf);
@@ -183,6 +184,27 @@ struct VM : VMBase
                             fputs((co->CycleStr() + " = coroutine\n").c_str(), leakf);
                             break;
                         }
+
+                        case V_PRIOQUEUE:
+                        {
+                            auto pq = (LPrioQueue *)vec;
+                            fputs((pq->CycleStr() + " = prioqueue\n").c_str(), leakf);
+                            break;
+                        }
+
+                        case V_STRBUILDER:
+                        {
+                            auto sb = (LStrBuilder *)vec;
+                            fputs((sb->CycleStr() + " = strbuilder\n").c_str(), leakf);
+                            break;
+                        }
+
+                        case V_HASHMAP:
+                        {
+                            auto hm = (LHashMap *)vec;
+                            fputs((hm->CycleStr() + " = " + hm->ToString(leakpp) + "\n").c_str(), leakf);
+                            break;
+                        }
                                     
                         default:
                         {
@@ -204,11 +226,31 @@ struct VM : VMBase
     
     #undef new
     LVector *NewVector(int n, int t) { return new (vmpool->alloc(sizeof(LVector) + sizeof(Value) * n)) LVector(n, t); }
+    LVector *NewVectorView(LVector *v, int start, int l, int t)
+    {
+        return new (vmpool->alloc(sizeof(LVector))) LVector(v, start, l, t);
+    }
     LString *NewString(int l) { return new (vmpool->alloc(sizeof(LString) + l + 1)) LString(l); }
+    LString *NewStringView(LString *s, int start, int l)
+    {
+        if (s->IsView() && s->view().parent)
+        {
+            start += int(s->view().start - s->view().parent->str());
+            s = s->view().parent;
+        }
+        return new (vmpool->alloc(sizeof(LString) + sizeof(StrView))) LString(s, start, l);
+    }
+    LString *NewExternalString(char *chars, int l, void (*release)(char *, int))
+    {
+        return new (vmpool->alloc(sizeof(LString) + sizeof(ExternalStr))) LString(chars, l, release);
+    }
     CoRoutine *NewCoRoutine(int *rip, int *vip, CoRoutine *p)
     {
         return new (vmpool->alloc(sizeof(CoRoutine))) CoRoutine(sp + 2 /* top of sp + pushed coro */, rip, vip, p);
     }
+    LHashMap *NewHashMap(int n) { return new (vmpool->alloc(sizeof(LHashMap))) LHashMap(n); }
+    LPrioQueue *NewPrioQueue() { return new (vmpool->alloc(sizeof(LPrioQueue))) LPrioQueue(); }
+    LStrBuilder *NewStrBuilder(int n) { return new (vmpool->alloc(sizeof(LStrBuilder))) LStrBuilder(n); }
     #ifdef WIN32
     #ifdef _DEBUG
     #define new DEBUG_NEW
@@ -704,8 +746,8 @@ struct VM : VMBase
                     trace_output += " [";
                     trace_output += inttoa(sp + 1);
                     trace_output += "] - ";
-                    if (sp >= 0) trace_output += TOP().ToString(debugpp);
-                    if (sp >= 1) { trace_output += " "; trace_output += TOP2().ToString(debugpp); }
+                    if (sp >= 0) TOP().ToString(trace_output, debugpp);
+                    if (sp >= 1) { trace_output += " "; TOP2().ToString(trace_output, debugpp); }
                     if (trace_tail)
                     {
                         trace_output += "\n";
@@ -857,7 +899,7 @@ struct VM : VMBase
                     Value v;
                     switch (nf->args.v.size())
                     {
-                        #define ARG(N) Value a##N = POP(); NFCheck(a##N, nf, N);
+                        #define ARG(N) Value a##N = POP(); NFCheck(a##N, nf, N); NFUnView(a##N, nf, N);
                         case 0: {                                           v = nf->fun.f0(); break; }
                         case 1: { ARG(0)                                    v = nf->fun.f1(a0); break; }
                         case 2: { ARG(1) ARG(0)                             v = nf->fun.f2(a0, a1); break; }
@@ -1044,7 +1086,7 @@ struct VM : VMBase
                 case IL_A2S:
                 {
                     Value a = POP();
-                    PUSH(NewString(a.ToString(programprintprefs)));   
+                    PUSH(NewString(ToStringBuf(a)));
                     a.DEC();
                     break;
                 }
@@ -1338,6 +1380,7 @@ struct VM : VMBase
     {
         if (v->type >= 0 && st.ReadOnlyType(v->type))
             Error(string("can't write to object of value type ") + ProperTypeName(Value(v)));
+        v->Unshare();
     }
 
     bool Coerce(Value &v, ValueType desired)
@@ -1349,9 +1392,9 @@ struct VM : VMBase
             case V_FLOAT:   if (v.type == V_INT) { v = Value((float)v.ival); return true; } break;
             case V_STRING:  if (v.type != V_STRING)
                             {
-                                auto s = v.ToString(programprintprefs);
+                                auto s = NewString(ToStringBuf(v));
                                 v.DEC();
-                                v = Value(NewString(s));
+                                v = Value(s);
                                 return true;
                             }
                             break;
@@ -1390,11 +1433,26 @@ struct VM : VMBase
         }
     }
 
+    void NFUnView(Value &v, NativeFun *nf, int i)
+    {
+        // most natives use the chars of a string as a zero terminated C string, which a view isn't
+        if (v.type == V_STRING && v.sval->IsView() && nf->args.v[i].flags != NF_STRVIEW)
+        {
+            auto s = NewString(v.sval->str(), v.sval->len);
+            v.DECRT();
+            v = Value(s);
+        }
+    }
+
     bool StrOps(const Value &a, const Value &b, Value &res)
     {
-        if      (a.type == V_STRING) { string s = b.ToString(programprintprefs); res = NewString(a.sval->str(), a.sval->len, (char *)s.c_str(), (int)s.size()); a.DEC(); b.DEC(); return true; }
-        else if (b.type == V_STRING) { string s = a.ToString(programprintprefs); res = NewString((char *)s.c_str(), (int)s.size(), b.sval->str(), b.sval->len); a.DEC(); b.DEC(); return true; }
-        return false;
+        // the non-string side is formatted into the shared buffer, then both go straight into the result
+        if      (a.type == V_STRING) { auto &s = ToStringBuf(b); res = NewString(a.sval->str(), a.sval->len, s.c_str(), (int)s.size()); }
+        else if (b.type == V_STRING) { auto &s = ToStringBuf(a); res = NewString(s.c_str(), (int)s.size(), b.sval->str(), b.sval->len); }
+        else return false;
+        a.DEC();
+        b.DEC();
+        return true;
     }
 
     void BError(const char *op, const Value &a, const Value &b) { Error(string("binary operator ") + op + " cannot operate on " + ProperTypeName(a) + " and " + ProperTypeName(b), a, b); }
@@ -1443,6 +1501,9 @@ struct VM : VMBase
         return 0;
     }
 
+    // the result can be written into a vector no-one else refers to, unless it shares its elements with others
+    bool CanReuse(const LVector *v) { return v->refc == 1 && !v->IsView(); }
+
     int VectorLoop(const Value &a, const Value &b, Value &res, bool &isfloat)
     {
         // note: not doing DEC() on the reused vectors is ok because VectorElem will error on not float/int
@@ -1457,18 +1518,18 @@ struct VM : VMBase
                 if (len && AllInt(a.vval) && AllInt(b.vval)) isfloat = false;
                 if(a.vval->len < b.vval->len || (a.vval->len == b.vval->len && a.vval->type >= 0))
                 {
-                    if (a.vval->refc == 1) { res = a; return len; } else type = a.vval->type;
+                    if (CanReuse(a.vval)) { res = a; return len; } else type = a.vval->type;
                 }
                 else
                 {
-                    if (b.vval->refc == 1) { res = b; return len; } else type = b.vval->type;
+                    if (CanReuse(b.vval)) { res = b; return len; } else type = b.vval->type;
                 }
             }
             else
             {
                 if (b.type == V_INT) { if (len && AllInt(a.vval)) isfloat = false; }
                 else if (b.type != V_FLOAT) return -1;
-                if (a.vval->refc == 1) { res = a; return len; }
+                if (CanReuse(a.vval)) { res = a; return len; }
                 type = a.vval->type;
             }
         }
@@ -1477,7 +1538,7 @@ struct VM : VMBase
             len = b.vval->len;
             if (a.type == V_INT) { if (len && AllInt(b.vval)) isfloat = false; }
             else if (b.type != V_FLOAT) return -1;
-            if (b.vval->refc == 1) { res = b; return len; }
+            if (CanReuse(b.vval)) { res = b; return len; }
             type = b.vval->type;
         }
         else
@@ -1557,6 +1618,15 @@ struct VM : VMBase
             r->refc = -r->refc;
         }
 
+        // views go first: while no leaked string or vector has been deleted yet, a negative refc on what they share
+        // tells us it is part of the leak as well, and will be deleted by this loop, rather than still in use
+        stable_partition(leaks.begin(), leaks.end(), [](void *p)
+        {
+            auto t = ((RefObj *)p)->type;
+            if (t == V_STRVIEW) return ((LString *)p)->view().parent != nullptr;
+            return (t == V_VECTOR || t >= 0) && ((LVector *)p)->IsView();
+        });
+
         for (auto p : leaks)
         {
             auto ro = (RefObj *)p;
@@ -1565,9 +1635,15 @@ struct VM : VMBase
             switch (ro->type)
             {
                 default: VMASSERT(ro->type >= 0);  // fall thru: a struct type
-                case V_VECTOR:    v.vval->len = 0; v.vval->deleteself(); break;
-                case V_STRING:                     v.sval->deleteself(); break;
+                case V_VECTOR:                     { auto shared = v.vval->shared;
+                                                     v.vval->deleteself(shared && shared->refc > 0); break; }
+                case V_STRING:                     v.sval->deleteself(false); break;
+                case V_STRVIEW:                    { auto parent = v.sval->view().parent;
+                                                     v.sval->deleteself(parent && parent->refc > 0); break; }
                 case V_COROUTINE:                  v.cval->deleteself(false); break;
+                case V_HASHMAP:                    v.hval->deleteself(false); break;
+                case V_PRIOQUEUE:                  v.qval->deleteself(); break;
+                case V_STRBUILDER:                 v.bval->deleteself(); break;
             }
         }
 
@@ -23,9 +23,12 @@ void Value::DECDELETE() const
     assert(ref->refc == 0);
     switch (type)
     {
-        case V_VECTOR:    vval->deleteself();     break;
-        case V_STRING:    sval->deleteself();     break;
+        case V_VECTOR:    vval->deleteself(true); break;
+        case V_STRING:    sval->deleteself(true); break;
         case V_COROUTINE: cval->deleteself(true); break;
+        case V_HASHMAP:   hval->deleteself(true); break;
+        case V_PRIOQUEUE: qval->deleteself();     break;
+        case V_STRBUILDER: bval->deleteself();    break;
         default:          assert(0);
     }
 }
@@ -43,6 +46,9 @@ bool Value::Equal(const Value &o, bool structural) const
         case V_STRING:      return (*sval) == (*o.sval);
         case V_VECTOR:      return vval == o.vval || (structural && vval->Equal(*o.vval));
         case V_COROUTINE:   return cval == o.cval;
+        case V_HASHMAP:     return hval == o.hval;
+        case V_PRIOQUEUE:   return qval == o.qval;
+        case V_STRBUILDER:  return bval == o.bval;
 
         case V_NIL:         return true;
         case V_FUNCTION:    return ip == o.ip;
@@ -51,24 +57,72 @@ bool Value::Equal(const Value &o, bool structural) const
     }
 }
 
-string Value::ToString(PrintPrefs &pp) const
+void Value::ToString(string &sd, PrintPrefs &pp) const
 {
     switch (type)
     {
-        case V_INT:       return inttoa(ival);
-        case V_FLOAT:     return flttoa(fval, pp.decimals);
+        case V_INT:       appendint(sd, ival); break;
+        case V_FLOAT:     appendflt(sd, fval, pp.decimals); break;
 
-        case V_STRING:    return sval->ToString(pp);
-        case V_VECTOR:    return vval->ToString(pp);
-        case V_COROUTINE: return "(coroutine)";
+        case V_STRING:    sval->ToString(sd, pp); break;
+        case V_VECTOR:    vval->ToString(sd, pp); break;
+        case V_COROUTINE: sd += "(coroutine)"; break;
+        case V_HASHMAP:   hval->ToString(sd, pp); break;
+        case V_PRIOQUEUE: sd += "(prioqueue)"; break;
+        case V_STRBUILDER: sd += "(strbuilder)"; break;
 
-        case V_NIL:       return "nil";
-        case V_FUNCTION:  return "<FUNCTION>";
-        case V_UNDEFINED: return "<UNDEFINED>";
-        default:            return string("<") + inttoa(type) + ">";
+        case V_NIL:       sd += "nil"; break;
+        case V_FUNCTION:  sd += "<FUNCTION>"; break;
+        case V_UNDEFINED: sd += "<UNDEFINED>"; break;
+        default:          sd += '<'; appendint(sd, type); sd += '>'; break;
     }
 }
 
+static uint HashMix(uint h)  // the murmur3 finalizer, so that similar keys spread out over the table
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+uint Value::Hash() const
+{
+    switch (type)
+    {
+        case V_INT:       return HashMix(ival);
+        case V_FLOAT:
+        {
+            auto f = fval == 0 ? 0.0f : fval;  // -0.0 == 0.0
+            uint u;
+            memcpy(&u, &f, sizeof(u));
+            return HashMix(u);
+        }
+        case V_STRING:
+        {
+            uint h = 2166136261u;  // FNV-1a
+            for (int i = 0; i < sval->len; i++) h = (h ^ (uchar)sval->str()[i]) * 16777619u;
+            return HashMix(h);
+        }
+        case V_VECTOR:
+        {
+            uint h = vval->len;
+            for (int i = 0; i < vval->len; i++) h = h * 31 + vval->at(i).Hash();
+            return HashMix(h);
+        }
+        default:          return HashMix(type);  // only equal by identity, or always equal
+    }
+}
+
+const string &VMBase::ToStringBuf(const Value &v)
+{
+    tostringbuf.clear();
+    v.ToString(tostringbuf, programprintprefs);
+    return tostringbuf;
+}
+
 void Value::Mark()
 {
     switch (type)
@@ -76,6 +130,9 @@ void Value::Mark()
         case V_STRING:    sval->Mark(); break; 
         case V_VECTOR:    vval->Mark(); break;
         case V_COROUTINE: cval->Mark(); break;
+        case V_HASHMAP:   hval->Mark(); break;
+        case V_PRIOQUEUE: qval->Mark(); break;
+        case V_STRBUILDER: bval->Mark(); break;
         default:          break;
     }
 }
@@ -18,7 +18,11 @@ namespace lobster {
 
 enum ValueType
 {
-    V_MINVMTYPES = -7,
+    V_MINVMTYPES = -11,
+    V_STRVIEW = -10,    // only used as memory type for strings that refer to part of another string, Values are V_STRING
+    V_STRBUILDER = -9,
+    V_PRIOQUEUE = -8,
+    V_HASHMAP = -7,
     V_STRUCT = -6,      // [typechecker only] an alias for V_VECTOR
     V_CYCLEDONE = -5,
     V_VALUEBUF = -4,    // only used as memory type for vector/coro buffers, Value not allowed to refer to this
@@ -43,7 +47,7 @@ inline const char *BaseTypeName(ValueType t)
 {
     static const char *typenames[] =
     {
-        "struct", "<cycle>", "<value_buffer>", "coroutine", "string", "vector", 
+        "<string_view>", "strbuilder", "prioqueue", "hashmap", "struct", "<cycle>", "<value_buffer>", "coroutine", "string", "vector", 
         "int", "float", "function", "nil", "undefined", "nilable", "any", "variable",
         "<retip>", "<funstart>", "<nargs>", "<deffun>", 
         "<logstart>", "<logend>", "<logmarker>", "<logfunwritestart>", "<logfunreadstart>"
@@ -57,6 +61,9 @@ struct Value;
 struct LString;
 struct LVector;
 struct CoRoutine;
+struct LHashMap;
+struct LPrioQueue;
+struct LStrBuilder;
 
 struct PrintPrefs
 {
@@ -74,8 +81,13 @@ struct VMBase
 {
     PrintPrefs programprintprefs;
 
+    string tostringbuf;  // reused by ToStringBuf(), so frequent conversions don't allocate
+
     VMBase() : programprintprefs(10, 10000, false, -1) {}
 
+    // Formats v using the program's print settings. The result is only valid until the next call.
+    const string &ToStringBuf(const Value &v);
+
     //virtual Value EvalC(Value &cl, int nargs) = 0;
     virtual Value BuiltinError(string err) = 0;
     virtual void BuiltinCheck(Value &v, ValueType desired, const char *name) = 0;
@@ -83,7 +95,13 @@ struct VMBase
     virtual Value Pop() = 0;
     virtual LString *NewString(const string &s) = 0;
     virtual LString *NewString(const char *c, int l) = 0;
+    virtual LString *NewStringView(LString *s, int start, int l) = 0;
+    virtual LString *NewExternalString(char *chars, int l, void (*release)(char *, int)) = 0;
     virtual LVector *NewVector(int n, int t) = 0;
+    virtual LVector *NewVectorView(LVector *v, int start, int l, int t) = 0;
+    virtual LHashMap *NewHashMap(int n) = 0;
+    virtual LPrioQueue *NewPrioQueue() = 0;
+    virtual LStrBuilder *NewStrBuilder(int n) = 0;
     virtual int GetVectorType(int which) = 0;
     virtual void Trace(bool on) = 0;
     virtual float Time() = 0;
@@ -131,59 +149,116 @@ struct LenObj : RefObj
     LenObj(int _t, int _l) : RefObj(_t), len(_l) {}
 };
 
+struct LString;
+
+struct StrView
+{
+    LString *parent;    // never a view itself, or nullptr if the chars are not owned by the VM (see ExternalStr)
+    char *start;
+};
+
+struct ExternalStr : StrView
+{
+    void (*release)(char *start, int len);  // called when the string is deleted, e.g. to unmap a file
+};
+
+// A string either stores its chars (zero terminated) right after itself, or is a view (type V_STRVIEW) that refers
+// to part of a parent string it keeps alive, or to external memory it releases, and is not zero terminated. Natives always get a plain copy of a view
+// unless their argument is marked to accept them, see VM::NFUnView().
 struct LString : LenObj
 {
     LString(int _l) : LenObj(V_STRING, _l) {}
+    LString(LString *parent, int start, int _l) : LenObj(V_STRVIEW, _l)
+    {
+        view().parent = parent;
+        view().start = parent->str() + start;
+        parent->refc++;
+    }
+    LString(char *chars, int _l, void (*release)(char *, int)) : LenObj(V_STRVIEW, _l)
+    {
+        view().parent = nullptr;
+        view().start = chars;
+        ((ExternalStr &)view()).release = release;
+    }
+
+    bool IsView() { return type == V_STRVIEW; }
+    StrView &view() { return *(StrView *)(this + 1); }
 
-    char *str() { return (char *)(this + 1); }
+    char *str() { return IsView() ? view().start : (char *)(this + 1); }
 
-    string ToString(PrintPrefs &pp)
+    string ToString(PrintPrefs &pp) { string sd; ToString(sd, pp); return sd; }
+
+    void ToString(string &sd, PrintPrefs &pp)
     {
-        if (pp.cycles >= 0)
+        if (pp.cycles >= 0 && type == V_CYCLEDONE) { sd += CycleStr(); return; }
+        auto s = str();  // before CycleDone() changes the type
+        if (pp.cycles >= 0) CycleDone(pp.cycles);
+        auto n = max(0, min(len, pp.budget));
+        if (!pp.quoted)
         {
-            if (type == V_CYCLEDONE) return CycleStr(); 
-            CycleDone(pp.cycles);
+            sd.append(s, n);
+            if (n < len) sd += "..";
+            return;
         }
-        string s = len > pp.budget ? string(str()).substr(0, pp.budget) + ".." : str();
-        if (pp.quoted)
+        sd += '\"';
+        for (int i = 0; i < n; i++) switch(s[i])
         {
-            string r = "\"";
-            for (size_t i = 0; i < s.length(); i++) switch(s[i])
-            {
-                case '\n': r += "\\n"; break;
-                case '\t': r += "\\t"; break;
-                case '\r': r += "\\r"; break;
-                case '\\': r += "\\\\"; break;
-                case '\"': r += "\\\""; break;
-                case '\'': r += "\\\'"; break;
-                default:
-                    if (s[i] >= ' ' && s[i] <= '~') r += s[i];
-                    else { 
-                        r += "\\x"; r += HexChar(((uchar)s[i]) >> 4); r += HexChar(s[i] & 0xF); }
-                    break;
-            }
+            case '\n': sd += "\\n"; break;
+            case '\t': sd += "\\t"; break;
+            case '\r': sd += "\\r"; break;
+            case '\\': sd += "\\\\"; break;
+            case '\"': sd += "\\\""; break;
+            case '\'': sd += "\\\'"; break;
+            default:
+                if (s[i] >= ' ' && s[i] <= '~') sd += s[i];
+                else { sd += "\\x"; sd += HexChar(((uchar)s[i]) >> 4); sd += HexChar(s[i] & 0xF); }
+                break;
+        }
+        if (n < len) sd += "..";
+        sd += '\"';
+    }
+
+    char HexChar(char i) { return i + (i < 10 ? '0' : 'A' - 10); }
+
+    void Mark()
+    {
+        if (refc < 0) return;
+        refc = -refc;
+        if (IsView() && view().parent) view().parent->Mark();
+    }
 
-            r += "\"";
-            return r; 
+    void deleteself(bool deref)
+    {
+        if (IsView() && !view().parent)
+        {
+            ((ExternalStr &)view()).release(view().start, len);
+            vmpool->dealloc(this, sizeof(LString) + sizeof(ExternalStr));
+        }
+        else if (IsView())
+        {
+            auto p = view().parent;
+            if (deref && --p->refc <= 0) p->deleteself(true);
+            vmpool->dealloc(this, sizeof(LString) + sizeof(StrView));
         }
         else
         {
-            return s;
+            vmpool->dealloc(this, sizeof(LString) + len + 1);
         }
     }
 
-    char HexChar(char i) { return i + (i < 10 ? '0' : 'A' - 10); }
-
-    void Mark() { if (refc > 0) refc = -refc; }
-
-    void deleteself() { vmpool->dealloc(this, sizeof(LString) + len + 1); }
+    // views aren't zero terminated, so these can't use strcmp
+    int Compare(LString &o)
+    {
+        auto c = memcmp(str(), o.str(), (size_t)(uint)min(len, o.len));
+        return c ? c : len - o.len;
+    }
 
-    bool operator==(LString &o) { return strcmp(str(), o.str()) == 0; }
-    bool operator!=(LString &o) { return strcmp(str(), o.str()) != 0; }
-    bool operator< (LString &o) { return strcmp(str(), o.str()) <  0; }
-    bool operator<=(LString &o) { return strcmp(str(), o.str()) <= 0; }
-    bool operator> (LString &o) { return strcmp(str(), o.str()) >  0; }
-    bool operator>=(LString &o) { return strcmp(str(), o.str()) >= 0; }
+    bool operator==(LString &o) { return len == o.len && !memcmp(str(), o.str(), len); }
+    bool operator!=(LString &o) { return !(*this == o); }
+    bool operator< (LString &o) { return Compare(o) <  0; }
+    bool operator<=(LString &o) { return Compare(o) <= 0; }
+    bool operator> (LString &o) { return Compare(o) >  0; }
+    bool operator>=(LString &o) { return Compare(o) >= 0; }
 };
 
 struct Value
@@ -197,6 +272,9 @@ struct Value
         LString *sval;
         LVector *vval;
         CoRoutine *cval;
+        LHashMap *hval;
+        LPrioQueue *qval;
+        LStrBuilder *bval;
         LenObj *lobj;
         RefObj *ref;
         int *ip;        // FAKE_COCLOSURE_ADDRESS means its a coroutine yield
@@ -214,6 +292,9 @@ struct Value
     inline Value(int *i, ValueType t) : type(t),           ip(i)   {}
     inline Value(LVector *v)          : type(V_VECTOR),    vval(v) {}
     inline Value(CoRoutine *c)        : type(V_COROUTINE), cval(c) {}
+    inline Value(LHashMap *h)         : type(V_HASHMAP),   hval(h) {}
+    inline Value(LPrioQueue *q)       : type(V_PRIOQUEUE), qval(q) {}
+    inline Value(LStrBuilder *b)      : type(V_STRBUILDER), bval(b) {}
     inline Value(RefObj *r)           : type(r->type >= 0 ? V_VECTOR : (ValueType)r->type), ref(r) {}
 
     inline bool True() const { return ival != 0; } // FIXME: not safe on 64bit systems unless we make ival 64bit also
@@ -255,8 +336,10 @@ struct Value
     void DECDELETE() const;
 
     bool Equal(const Value &o, bool structural) const;
+    uint Hash() const;  // consistent with Equal(o, true)
 
-    string ToString(PrintPrefs &pp) const;
+    string ToString(PrintPrefs &pp) const { string sd; ToString(sd, pp); return sd; }
+    void ToString(string &sd, PrintPrefs &pp) const;  // appends to sd
     void Mark();
 };
 
@@ -283,6 +366,9 @@ inline void DeallocSubBuf(Value *v, size_t size)
     vmpool->dealloc(mem, size * sizeof(Value) + sizeof(void *));
 }
 
+// A vector either owns its elements, or is a view that shares them with other vectors: v then points into the
+// elements of shared, a hidden vector that owns them, and all vectors that share it hold a reference to it. Reading
+// works the same either way, but a view must get its own copy of the elements before changing them, see Unshare().
 struct LVector : LenObj
 {
     private:
@@ -291,24 +377,68 @@ struct LVector : LenObj
     public:
     int maxl;
     int initiallen;
+    LVector *shared;    // set if this is a view, never a view itself
 
-    LVector(int _size, int _t) : LenObj(_t, 0), maxl(_size), initiallen(_size)
+    LVector(int _size, int _t) : LenObj(_t, 0), maxl(_size), initiallen(_size), shared(nullptr)
     {
         v = (Value *)(this + 1);
     }
+    LVector(LVector *from, int start, int _l, int _t) : LenObj(_t, _l), maxl(_l), initiallen(0)
+    {
+        if (!from->shared) from->Share();
+        shared = from->shared;
+        shared->refc++;
+        v = from->v + start;
+    }
 
     ~LVector() { assert(0); }   // destructed by DECREF
 
+    bool IsView() const { return shared != nullptr; }
+
+    // Moves our elements into a new vector, so we and views of us can share them. If they're stored inline they
+    // have to be copied, otherwise the buffer is handed over as is.
+    void Share()
+    {
+        bool isinline = v == (Value *)(this + 1);
+        shared = g_vm->NewVector(isinline ? len : 0, V_VECTOR);
+        if (isinline) memcpy(shared->v, v, sizeof(Value) * len);
+        else { shared->v = v; shared->maxl = maxl; }
+        shared->len = len;
+        v = shared->v;
+        maxl = len;
+    }
+
+    // Copy-on-write: must be called before changing the elements of a vector that may be a view.
+    void Unshare()
+    {
+        if (!shared) return;
+        auto mem = len <= initiallen ? (Value *)(this + 1) : AllocSubBuf(len);
+        memcpy(mem, v, sizeof(Value) * len);
+        for (int i = 0; i < len; i++) mem[i].INC();
+        v = mem;
+        maxl = max(len, initiallen);
+        auto s = shared;
+        shared = nullptr;
+        if (--s->refc <= 0) s->deleteself(true);
+    }
+
     void deallocbuf()
     {
         if (v == (Value *)(this + 1)) return;
         DeallocSubBuf(v, maxl);
     }
 
-    void deleteself()
+    void deleteself(bool deref)
     {
-        DeRef();
-        deallocbuf();
+        if (shared)
+        {
+            if (deref && --shared->refc <= 0) shared->deleteself(true);
+        }
+        else
+        {
+            if (deref) DeRef();
+            deallocbuf();
+        }
         vmpool->dealloc(this, sizeof(LVector) + sizeof(Value) * initiallen);
     }
 
@@ -324,12 +454,14 @@ struct LVector : LenObj
 
     void push(const Value &val)
     {
+        Unshare();
         if (len == maxl) resize(maxl ? maxl * 2 : 4);
         v[len++] = val;
     }
 
     Value pop()
     {
+        if (shared) return v[--len].INC();  // a view can just get shorter
         return v[--len];
     }
 
@@ -341,6 +473,7 @@ struct LVector : LenObj
     void insert(Value &val, int i, int n)
     {
         assert(n > 0 && i >= 0 && i <= len); // note: insertion right at the end is legal, hence <= 
+        Unshare();
         if (len + n > maxl) resize(max(len + n, maxl ? maxl * 2 : 4));   
         memmove(v + i + n, v + i, sizeof(Value) * (len - i));
         len++;
@@ -351,6 +484,7 @@ struct LVector : LenObj
     Value remove(int i, int n)
     { 
         assert(n >= 0 && n <= len && i >= 0 && i <= len - n);
+        Unshare();
         auto x = v[i];
         for (int j = 1; j < n; j++) v[i + j].DEC();
         memmove(v + i, v + i + n, sizeof(Value) * (len - i - n));
@@ -366,35 +500,48 @@ struct LVector : LenObj
 
     void append(LVector *from, int start, int amount)
     {
+        Unshare();
         if (len + amount > maxl) resize(len + amount);  // FIXME: check overflow
         memcpy(v + len, from->v + start, sizeof(Value) * amount);
         for (int i = 0; i < amount; i++) v[len + i].INC();
         len += amount;
     }
 
-    string ToString(PrintPrefs &pp)
+    string ToString(PrintPrefs &pp) { string sd; ToString(sd, pp); return sd; }
+
+    void ToString(string &sd, PrintPrefs &pp)
     {
         if (pp.cycles >= 0)
         {
-            if (type == V_CYCLEDONE) return CycleStr(); 
+            if (type == V_CYCLEDONE) { sd += CycleStr(); return; }
             CycleDone(pp.cycles);
         }
 
-        string s = "[";
+        auto start = sd.size();
+        sd += '[';
+        PrintPrefs subpp(pp.depth - 1, 0, true, pp.decimals);  // budget gets set per element
         for (int i = 0; i < len; i++)
         {
-            if (i) s += ", ";
-            if ((int)s.size() > pp.budget) { s += "...."; break; }
-            PrintPrefs subpp(pp.depth - 1, pp.budget - s.size(), true, pp.decimals);
-            s += pp.depth || v[i].type >= 0 ? v[i].ToString(subpp) : "..";
+            if (i) sd += ", ";
+            auto sofar = (int)(sd.size() - start);
+            if (sofar > pp.budget) { sd += "...."; break; }
+            if (pp.depth || v[i].type >= 0)
+            {
+                subpp.budget = pp.budget - sofar;
+                v[i].ToString(sd, subpp);
+            }
+            else
+            {
+                sd += "..";
+            }
         }
-        s += "]";
-        if (type >= 0) s += ":" + g_vm->ReverseLookupType(type);
-        return s;
+        sd += ']';
+        if (type >= 0) { sd += ':'; sd += g_vm->ReverseLookupType(type); }
     }
 
     bool Equal(LVector &o)
     {
+        if (len != o.len) return false;
         for (int i = 0; i < len; i++) if (!v[i].Equal(o.v[i], true)) return false;
         return true;
     }
@@ -408,7 +555,8 @@ struct LVector : LenObj
     {
         if (refc < 0) return;
         refc = -refc;
-        for (int i = 0; i < len; i++) v[i].Mark();
+        if (shared) shared->Mark();
+        else for (int i = 0; i < len; i++) v[i].Mark();
     }
 };
 
@@ -527,6 +675,201 @@ struct CoRoutine : RefObj
     }
 };
 
+// A hash table from int/float/string/vector keys to any values, using open addressing with linear probing.
+// Keys compare like equal() does, so two structs with the same contents are the same key. This also means a vector
+// that gets modified after it was used as a key won't be found anymore.
+struct LHashMap : LenObj  // len is the number of entries
+{
+    Value *slots;   // key/value pairs, empty slots have an undefined key, with ival 1 if it was removed
+    int cap;        // number of pairs, always a power of 2
+    int used;       // entries + removed entries, decides when to grow
+
+    LHashMap(int _n) : LenObj(V_HASHMAP, 0), cap(4), used(0)
+    {
+        while (cap * 3 < _n * 4) cap *= 2;
+        slots = NewSlots(cap);
+    }
+
+    ~LHashMap() { assert(0); }   // destructed by DECREF
+
+    static Value *NewSlots(int n)
+    {
+        auto s = AllocSubBuf(n * 2);
+        for (int i = 0; i < n * 2; i++) s[i] = Value();
+        return s;
+    }
+
+    Value &Key(int i) const { return slots[i * 2]; }
+    Value &Val(int i) const { return slots[i * 2 + 1]; }
+    bool Used(int i) const { return Key(i).type != V_UNDEFINED; }
+
+    // Returns the slot where key is stored, or if not present, the slot where it should go.
+    int Lookup(const Value &key) const
+    {
+        int mask = cap - 1;
+        int insertat = -1;
+        for (int i = key.Hash() & mask; ; i = (i + 1) & mask)
+        {
+            auto &k = Key(i);
+            if (k.type == V_UNDEFINED)
+            {
+                if (!k.ival) return insertat >= 0 ? insertat : i;
+                if (insertat < 0) insertat = i;
+            }
+            else if (k.Equal(key, true))
+            {
+                return i;
+            }
+        }
+    }
+
+    Value *Find(const Value &key) const
+    {
+        int i = Lookup(key);
+        return Used(i) ? &Val(i) : nullptr;
+    }
+
+    // Takes over the reference to both key and val.
+    void Set(const Value &key, const Value &val)
+    {
+        if ((used + 1) * 4 > cap * 3) Rehash(len * 2 >= cap ? cap * 2 : cap);  // otherwise just drop removed ones
+        int i = Lookup(key);
+        if (Used(i))
+        {
+            key.DEC();
+            Val(i).DEC();
+        }
+        else
+        {
+            if (!Key(i).ival) used++;
+            Key(i) = key;
+            len++;
+        }
+        Val(i) = val;
+    }
+
+    // Returns the value that was stored (the caller now owns its reference), or nil.
+    Value Remove(const Value &key)
+    {
+        int i = Lookup(key);
+        if (!Used(i)) return Value(0, V_NIL);
+        Key(i).DEC();
+        Key(i) = Value(1, V_UNDEFINED);
+        auto v = Val(i);
+        Val(i) = Value();
+        len--;
+        return v;
+    }
+
+    void Rehash(int newcap)
+    {
+        auto oldslots = slots;
+        auto oldcap = cap;
+        slots = NewSlots(newcap);
+        cap = newcap;
+        used = len;
+        int mask = cap - 1;
+        for (int j = 0; j < oldcap; j++)
+        {
+            auto &k = oldslots[j * 2];
+            if (k.type == V_UNDEFINED) continue;
+            int i = k.Hash() & mask;
+            while (Used(i)) i = (i + 1) & mask;  // keys are unique, so no need to compare
+            Key(i) = k;
+            Val(i) = oldslots[j * 2 + 1];
+        }
+        DeallocSubBuf(oldslots, oldcap * 2);
+    }
+
+    void deleteself(bool deref)
+    {
+        if (deref) for (int i = 0; i < cap; i++) if (Used(i)) { Key(i).DEC(); Val(i).DEC(); }
+        DeallocSubBuf(slots, cap * 2);
+        vmpool->dealloc(this, sizeof(LHashMap));
+    }
+
+    string ToString(PrintPrefs &pp) { string sd; ToString(sd, pp); return sd; }
+
+    void ToString(string &sd, PrintPrefs &pp)
+    {
+        if (pp.cycles >= 0)
+        {
+            if (type == V_CYCLEDONE) { sd += CycleStr(); return; }
+            CycleDone(pp.cycles);
+        }
+
+        auto start = sd.size();
+        sd += '{';
+        PrintPrefs subpp(pp.depth - 1, 0, true, pp.decimals);
+        bool first = true;
+        for (int i = 0; i < cap; i++) if (Used(i))
+        {
+            if (!first) sd += ", ";
+            first = false;
+            auto sofar = (int)(sd.size() - start);
+            if (sofar > pp.budget) { sd += "...."; break; }
+            if (!pp.depth) { sd += ".."; continue; }
+            subpp.budget = pp.budget - sofar;
+            Key(i).ToString(sd, subpp);
+            sd += ": ";
+            Val(i).ToString(sd, subpp);
+        }
+        sd += '}';
+    }
+
+    void Mark()
+    {
+        if (refc < 0) return;
+        refc = -refc;
+        for (int i = 0; i < cap; i++) if (Used(i)) { Key(i).Mark(); Val(i).Mark(); }
+    }
+};
+
+// Makes a PrioQueue available to Lobster code. It only holds ints, so never refers to other objects.
+struct LPrioQueue : LenObj  // len is the number of queued ids, call Sync() after modifying pq
+{
+    PrioQueue pq;
+
+    LPrioQueue() : LenObj(V_PRIOQUEUE, 0) {}
+
+    void Sync() { len = (int)pq.Size(); }
+
+    void deleteself()
+    {
+        this->~LPrioQueue();
+        vmpool->dealloc(this, sizeof(LPrioQueue));
+    }
+
+    void Mark()
+    {
+        if (refc < 0) return;
+        refc = -refc;
+    }
+};
+
+// A growable buffer for building up large strings with amortized appends, rather than creating a new string
+// for every +. Only holds characters, so never refers to other objects.
+struct LStrBuilder : LenObj  // len is the number of chars in buf, call Sync() after modifying it
+{
+    string buf;
+
+    LStrBuilder(int n) : LenObj(V_STRBUILDER, 0) { buf.reserve(n); }
+
+    void Sync() { len = (int)buf.size(); }
+
+    void deleteself()
+    {
+        this->~LStrBuilder();
+        vmpool->dealloc(this, sizeof(LStrBuilder));
+    }
+
+    void Mark()
+    {
+        if (refc < 0) return;
+        refc = -refc;
+    }
+};
+
 template<typename T> inline T ValueTo(const Value &v, float def = 0)
 {
     if (v.type == V_VECTOR)